@@ -18,83 +18,333 @@
 
 #include "cvs.h"
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
 
-typedef uint32_t	crc32_t;
+/*
+ * Strings are interned in a chained table that doubles whenever it
+ * holds more strings than buckets.  Entries and their text come from
+ * an arena and only go away with discard_atoms().  Each entry keeps
+ * its full hash and length, so a chain is mostly walked without
+ * touching the text.
+ *
+ * The loader threads all intern into the same tables, so each is
+ * split into shards picked by the top bits of the hash, every shard
+ * with its own lock, buckets and arena.  A given string or number
+ * always lands in the same shard, so interned copies stay unique
+ * and can still be compared by address.
+ */
+#define ATOM_SHARDS	64
+#define ATOM_SHARD_BITS	6
+
+typedef struct _hash_bucket {
+    struct _hash_bucket	*next;
+    uint64_t		hash;
+    size_t		len;
+    char		string[0];
+} hash_bucket_t;
 
-static crc32_t crc32_table[256];
+static struct atom_shard {
+    pthread_mutex_t	lock;
+    hash_bucket_t	**buckets;
+    size_t		nbuckets, natoms;
+    arena		arena;
+} __attribute__((aligned (64))) atom_shards[ATOM_SHARDS] = {
+    [0 ... ATOM_SHARDS - 1] = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.arena = { .kind = MEM_ATOM },
+    },
+};
 
-static void
-generate_crc32_table(void)
+/*
+ * Each interned number links to the interned number one component
+ * shorter, so the branch and branch point of a revision are a pointer
+ * or two away rather than a copy and a lookup.  Numbers are sharded
+ * and kept like the strings: chains that double with the count, and
+ * entries from the shard's arena.
+ */
+typedef struct _number_bucket {
+    struct _number_bucket	*next;
+    uint32_t			hash;
+    cvs_number			*up;
+    cvs_number			number;
+} number_bucket_t;
+
+static struct number_shard {
+    pthread_mutex_t	lock;
+    number_bucket_t	**buckets;
+    size_t		nbuckets, nnumbers;
+    arena		arena;
+} __attribute__((aligned (64))) number_shards[ATOM_SHARDS] = {
+    [0 ... ATOM_SHARDS - 1] = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.arena = { .kind = MEM_NUMBER },
+    },
+};
+
+#define HASH_MUL	0x9e3779b97f4a7c15ULL
+
+static uint64_t
+hash_string (const char *s, size_t len)
+/* 64-bit multiply-mix over the string, eight bytes at a time */
 {
-    crc32_t	c, p;
-    int		n, m;
-
-    p = 0xedb88320;
-    for (n = 0; n < 256; n++)
-    {
-	c = n;
-	for (m = 0; m < 8; m++)
-	    c = (c >> 1) ^ ((c & 1) ? p : 0);
-	crc32_table[n] = c;
+    uint64_t	h = len * HASH_MUL, w;
+
+    for (; len >= 8; s += 8, len -= 8) {
+	memcpy (&w, s, 8);
+	h = (h ^ w) * HASH_MUL;
+	h ^= h >> 32;
     }
+    w = 0;
+    memcpy (&w, s, len);
+    h = (h ^ w) * HASH_MUL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
 }
 
-static crc32_t
-crc32 (char *string)
+static void
+atom_grow (struct atom_shard *sh)
+/* double a shard's bucket array and spread the chains over it */
 {
-    crc32_t		crc32 = ~0;
-    unsigned char	c;
+    size_t		size = sh->nbuckets ? sh->nbuckets * 2 : 256;
+    hash_bucket_t	**table = calloc (size, sizeof (hash_bucket_t *));
+    hash_bucket_t	*b, *next;
+    size_t		i;
 
-    if (crc32_table[1] == 0) generate_crc32_table ();
-    while ((c = (unsigned char) *string++))
-	crc32 = (crc32 >> 8) ^ crc32_table[(crc32 ^ c) & 0xff];
-    return ~crc32;
+    for (i = 0; i < sh->nbuckets; i++)
+	for (b = sh->buckets[i]; b; b = next) {
+	    next = b->next;
+	    b->next = table[b->hash & (size - 1)];
+	    table[b->hash & (size - 1)] = b;
+	}
+    mem_charge (MEM_ATOM, 0, (size - sh->nbuckets) * sizeof (hash_bucket_t *));
+    free (sh->buckets);
+    sh->buckets = table;
+    sh->nbuckets = size;
 }
 
-#define HASH_SIZE	9013	/* prime for netterr hash performance */
-
-typedef struct _hash_bucket {
-    struct _hash_bucket	*next;
-    crc32_t		crc;
-    char		string[0];
-} hash_bucket_t;
-
-static hash_bucket_t	*buckets[HASH_SIZE];
-
 char *
 atom (char *string)
 /* intern a string, avoiding having separate storage for duplicate copies */
 {
-    crc32_t		crc = crc32 (string);
-    hash_bucket_t	**head = &buckets[crc % HASH_SIZE];
+    size_t		len = strlen (string);
+    uint64_t		hash = hash_string (string, len);
+    struct atom_shard	*sh = &atom_shards[hash >> (64 - ATOM_SHARD_BITS)];
+    hash_bucket_t	**head;
     hash_bucket_t	*b;
-    int			len = strlen (string);
 
+    pthread_mutex_lock (&sh->lock);
+    if (sh->natoms >= sh->nbuckets)
+	atom_grow (sh);
+    head = &sh->buckets[hash & (sh->nbuckets - 1)];
     while ((b = *head)) {
-	if (b->crc == crc && !strcmp (string, b->string))
+	if (b->hash == hash && b->len == len &&
+	    !memcmp (string, b->string, len)) {
+	    pthread_mutex_unlock (&sh->lock);
 	    return b->string;
+	}
 	head = &(b->next);
     }
-    b = malloc (sizeof (hash_bucket_t) + len + 1);
-    b->next = 0;
-    b->crc = crc;
+    b = arena_alloc (&sh->arena, sizeof (hash_bucket_t) + len + 1);
+    b->hash = hash;
+    b->len = len;
     memcpy (b->string, string, len + 1);
     *head = b;
+    sh->natoms++;
+    pthread_mutex_unlock (&sh->lock);
     return b->string;
 }
 
+static void
+string_report (FILE *f)
+/* describe how full the string table is */
+{
+    size_t		i, used = 0, len, longest = 0;
+    size_t		natoms = 0, nbuckets = 0;
+    hash_bucket_t	*b;
+    int			s;
+
+    for (s = 0; s < ATOM_SHARDS; s++) {
+	struct atom_shard   *sh = &atom_shards[s];
+
+	natoms += sh->natoms;
+	nbuckets += sh->nbuckets;
+	for (i = 0; i < sh->nbuckets; i++) {
+	    for (len = 0, b = sh->buckets[i]; b; b = b->next)
+		len++;
+	    if (len)
+		used++;
+	    if (len > longest)
+		longest = len;
+	}
+    }
+    if (nbuckets)
+	fprintf (f, "%zu atoms in %zu buckets over %d shards: load %.2f, "
+		 "%zu buckets used, longest chain %zu\n",
+		 natoms, nbuckets, ATOM_SHARDS, (double) natoms / nbuckets,
+		 used, longest);
+}
+
+static void
+number_report (FILE *f)
+/* describe how full the number table is */
+{
+    size_t		i, used = 0, len, longest = 0;
+    size_t		nnumbers = 0, nbuckets = 0;
+    number_bucket_t	*b;
+    int			s;
+
+    for (s = 0; s < ATOM_SHARDS; s++) {
+	struct number_shard *sh = &number_shards[s];
+
+	nnumbers += sh->nnumbers;
+	nbuckets += sh->nbuckets;
+	for (i = 0; i < sh->nbuckets; i++) {
+	    for (len = 0, b = sh->buckets[i]; b; b = b->next)
+		len++;
+	    if (len)
+		used++;
+	    if (len > longest)
+		longest = len;
+	}
+    }
+    if (nbuckets)
+	fprintf (f, "%zu numbers in %zu buckets over %d shards: load %.2f, "
+		 "%zu buckets used, longest chain %zu\n",
+		 nnumbers, nbuckets, ATOM_SHARDS, (double) nnumbers / nbuckets,
+		 used, longest);
+}
+
 void
-discard_atoms (void)
-/* empty all string buckets */
+atom_report (FILE *f)
+/* describe how full the string and number tables are */
 {
-    hash_bucket_t	**head, *b;
-    int			i;
+    string_report (f);
+    number_report (f);
+}
+
+static uint32_t
+hash_cvs_number (cvs_number *n)
+{
+    uint32_t	h = 2166136261u ^ n->c;
+    int		i;
+
+    for (i = 0; i < n->c; i++)
+	h = (h ^ (unsigned short) n->n[i]) * 16777619u;
+    return h;
+}
 
-    for (i = 0; i < HASH_SIZE; i++)
-	for (head = &buckets[i]; (b = *head);) {
-	    *head = b->next;
-	    free (b);
+static void
+number_grow (struct number_shard *sh)
+/* double a number shard's bucket array and spread the chains over it */
+{
+    size_t		size = sh->nbuckets ? sh->nbuckets * 2 : 256;
+    number_bucket_t	**table = calloc (size, sizeof (number_bucket_t *));
+    number_bucket_t	*b, *next;
+    size_t		i;
+
+    for (i = 0; i < sh->nbuckets; i++)
+	for (b = sh->buckets[i]; b; b = next) {
+	    next = b->next;
+	    b->next = table[b->hash & (size - 1)];
+	    table[b->hash & (size - 1)] = b;
 	}
+    mem_charge (MEM_NUMBER, 0,
+		(size - sh->nbuckets) * sizeof (number_bucket_t *));
+    free (sh->buckets);
+    sh->buckets = table;
+    sh->nbuckets = size;
+}
+
+static number_bucket_t **
+number_find (struct number_shard *sh, cvs_number *n, uint32_t hash)
+/* find n's place in a shard, whose lock must be held */
+{
+    number_bucket_t	**head;
+    number_bucket_t	*b;
+
+    if (sh->nnumbers >= sh->nbuckets)
+	number_grow (sh);
+    head = &sh->buckets[hash & (sh->nbuckets - 1)];
+
+    while ((b = *head)) {
+	if (b->hash == hash && b->number.c == n->c &&
+	    !memcmp (b->number.n, n->n, n->c * sizeof (short)))
+	    break;
+	head = &(b->next);
+    }
+    return head;
+}
+
+cvs_number *
+atom_cvs_number (cvs_number *n)
+/* intern a revision number, so equal numbers share one copy */
+{
+    uint32_t		hash = hash_cvs_number (n);
+    struct number_shard	*sh = &number_shards[hash >> (32 - ATOM_SHARD_BITS)];
+    number_bucket_t	**head, *b;
+    cvs_number		up, *upatom = NULL;
+
+    pthread_mutex_lock (&sh->lock);
+    b = *number_find (sh, n, hash);
+    pthread_mutex_unlock (&sh->lock);
+    if (b)
+	return &b->number;
+    /* the prefix may live in another shard, so intern it unlocked */
+    if (n->c > 0) {
+	up = *n;
+	up.c--;
+	upatom = atom_cvs_number (&up);
+    }
+    pthread_mutex_lock (&sh->lock);
+    head = number_find (sh, n, hash);
+    if (!(b = *head)) {
+	b = arena_alloc (&sh->arena, sizeof (number_bucket_t));
+	sh->nnumbers++;
+	b->hash = hash;
+	b->up = upatom;
+	b->number.c = n->c;
+	memcpy (b->number.n, n->n, n->c * sizeof (short));
+	*head = b;
+    }
+    pthread_mutex_unlock (&sh->lock);
+    return &b->number;
+}
+
+cvs_number *
+cvs_number_prefix (cvs_number *n, int depth)
+/* an interned number less its last depth components, or NULL */
+{
+    while (n && depth--)
+	n = ((number_bucket_t *) ((char *) n -
+				  offsetof (number_bucket_t, number)))->up;
+    return n;
+}
+
+void
+discard_atoms (void)
+/* empty all string and number buckets */
+{
+    int			s;
+
+    for (s = 0; s < ATOM_SHARDS; s++) {
+	struct atom_shard   *sh = &atom_shards[s];
+	struct number_shard *nsh = &number_shards[s];
+
+	arena_free (&sh->arena);
+	mem_charge (MEM_ATOM, 0,
+		    -(long) (sh->nbuckets * sizeof (hash_bucket_t *)));
+	free (sh->buckets);
+	sh->buckets = NULL;
+	sh->nbuckets = sh->natoms = 0;
+	arena_free (&nsh->arena);
+	mem_charge (MEM_NUMBER, 0,
+		    -(long) (nsh->nbuckets * sizeof (number_bucket_t *)));
+	free (nsh->buckets);
+	nsh->buckets = NULL;
+	nsh->nbuckets = nsh->nnumbers = 0;
+    }
 }
 
 /* end */
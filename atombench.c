@@ -0,0 +1,160 @@
+/*
+ * Contention benchmark for the sharded atom tables.
+ *
+ * Each thread interns the same set of names, commitids and
+ * revision numbers, every thread in its own order, the way the
+ * loader threads do when they work through a repository that
+ * shares its authors and branches.  The tables are emptied between
+ * thread counts, so each run starts with the inserts and settles
+ * into lookups.  Every thread must get back the same pointer for a
+ * given key, or the run fails.
+ *
+ * usage: atombench [-k keys] [-p passes]
+ */
+
+#include "cvs.h"
+#include <pthread.h>
+
+/* generate.o wants this from main.c */
+bool suppress_keyword_expansion = false;
+
+static int	nkeys = 20000;
+static int	passes = 20;
+
+static char		**keys;
+static cvs_number	*numbers;
+
+struct worker {
+    pthread_t	thread;
+    unsigned	seed;
+    char	**strings;
+    cvs_number	**nums;
+};
+
+static void *
+intern_keys (void *arg)
+/* intern every key passes times, in an order of this thread's own */
+{
+    struct worker	*w = arg;
+    unsigned		r = w->seed;
+    int			p, i, k;
+
+    for (p = 0; p < passes; p++)
+	for (i = 0; i < nkeys; i++) {
+	    r = r * 1103515245 + 12345;
+	    k = (r >> 8) % nkeys;
+	    w->strings[k] = atom (keys[k]);
+	    w->nums[k] = atom_cvs_number (&numbers[k]);
+	}
+    return NULL;
+}
+
+static double
+now (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+make_keys (void)
+/* a mix of author names, commitids and log lines, and branch revisions */
+{
+    char	buf[64];
+    int		i;
+
+    keys = xmalloc (nkeys * sizeof (char *));
+    numbers = xmalloc (nkeys * sizeof (cvs_number));
+    for (i = 0; i < nkeys; i++) {
+	switch (i % 3) {
+	case 0:
+	    snprintf (buf, sizeof (buf), "user%d", i);
+	    break;
+	case 1:
+	    snprintf (buf, sizeof (buf), "1004C%011X", i * 2654435761u);
+	    break;
+	default:
+	    snprintf (buf, sizeof (buf), "fix bug %d in the parser", i);
+	    break;
+	}
+	keys[i] = strdup (buf);
+	numbers[i].c = i % 2 ? 4 : 2;
+	numbers[i].n[0] = 1;
+	numbers[i].n[1] = i % 2 ? 1 + i % 50 : 1 + i;
+	numbers[i].n[2] = 2 * (1 + i % 7);
+	numbers[i].n[3] = 1 + i / 350;
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+    static const int	counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+    struct worker	w[64];
+    double		t;
+    int			c, i, k, n, t0;
+
+    while ((c = getopt (argc, argv, "k:p:")) != -1) {
+	switch (c) {
+	case 'k':
+	    nkeys = atoi (optarg);
+	    break;
+	case 'p':
+	    passes = atoi (optarg);
+	    break;
+	default:
+	    fprintf (stderr, "usage: atombench [-k keys] [-p passes]\n");
+	    exit (1);
+	}
+    }
+    if (nkeys <= 0 || passes <= 0) {
+	fprintf (stderr, "atombench: keys and passes must be positive\n");
+	exit (1);
+    }
+    make_keys ();
+    for (i = 0; i < 64; i++) {
+	w[i].strings = xmalloc (nkeys * sizeof (char *));
+	w[i].nums = xmalloc (nkeys * sizeof (cvs_number *));
+    }
+
+    printf ("%d keys, %d passes per thread\n", nkeys, passes);
+    printf ("threads  seconds   Mops/s  ns/op/thread\n");
+    for (c = 0; c < sizeof (counts) / sizeof (counts[0]); c++) {
+	n = counts[c];
+	for (i = 0; i < n; i++) {
+	    w[i].seed = 7919 * (i + 1);
+	    memset (w[i].strings, 0, nkeys * sizeof (char *));
+	    memset (w[i].nums, 0, nkeys * sizeof (cvs_number *));
+	}
+	t = now ();
+	for (i = 0; i < n; i++)
+	    if (pthread_create (&w[i].thread, NULL, intern_keys, &w[i])) {
+		perror ("pthread_create");
+		exit (1);
+	    }
+	for (i = 0; i < n; i++)
+	    pthread_join (w[i].thread, NULL);
+	t = now () - t;
+
+	/* a key not drawn by a thread is still NULL there */
+	for (k = 0; k < nkeys; k++) {
+	    for (t0 = 0; t0 < n && !w[t0].strings[k]; t0++)
+		;
+	    for (i = t0 + 1; i < n; i++)
+		if ((w[i].strings[k] && w[i].strings[k] != w[t0].strings[k]) ||
+		    (w[i].nums[k] && w[i].nums[k] != w[t0].nums[k])) {
+		    fprintf (stderr, "atombench: %d threads interned \"%s\" twice\n",
+			     n, keys[k]);
+		    exit (1);
+		}
+	}
+	/* two interns per draw */
+	printf ("%7d  %7.3f  %7.2f  %12.1f\n", n, t,
+		2.0 * nkeys * passes * n / t / 1e6,
+		t * 1e9 / (2.0 * nkeys * passes));
+	discard_atoms ();
+    }
+    return 0;
+}
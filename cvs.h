@@ -46,13 +46,57 @@ typedef struct _cvs_number {
     short		n[CVS_MAX_DEPTH];
 } cvs_number;
 
+/*
+ * Revision numbers kept in the parse and revision structures are
+ * interned with atom_cvs_number(), like strings with atom(), so they
+ * cost a pointer apiece however many revisions share them, and two
+ * of them are equal exactly when the pointers are.  Plain cvs_number
+ * values are for working out new numbers.
+ */
+
+/*
+ * What --mem-stats keeps count of
+ */
+enum mem_kind {
+    MEM_PARSE,		/* cvs_* structures */
+    MEM_NODE,		/* Nodes and their index */
+    MEM_IMAGE,		/* in-core images of masters */
+    MEM_ATOM,		/* interned strings */
+    MEM_NUMBER,		/* interned revision numbers */
+    MEM_COMMIT,		/* rev_commits, per master and merged */
+    MEM_FILE,		/* rev_files and their index */
+    MEM_DIR,		/* packed rev_dirs */
+    MEM_TAG,		/* Tags and their commit chunks */
+    MEM_SPOOL,		/* blobs waiting on disk for export */
+    MEM_MARKMAP,	/* export marks */
+    NMEM
+};
+
+extern bool mem_stats;
+
+/*
+ * Bump allocator for the parse structures of one master; they all
+ * go at once when the master is done with.
+ */
+typedef struct _arena_block {
+    struct _arena_block	*next;
+    size_t		size, used;
+    char		data[];
+} arena_block;
+
+typedef struct _arena {
+    arena_block		*blocks;
+    unsigned long	nalloc;		/* objects handed out */
+    unsigned long	nblocks;	/* blocks malloc()ed */
+    enum mem_kind	kind;		/* what the blocks are charged to */
+} arena;
+
 struct _cvs_version;
 struct _cvs_patch;
 struct _rev_file;
 
 typedef struct node {
-	struct node *hash_next;
-	cvs_number number;
+	cvs_number *number;
 	struct _cvs_version *v;
 	struct _cvs_patch *p;
 	struct node *next;
@@ -63,44 +107,69 @@ typedef struct node {
 	int starts;
 } Node;
 
+/*
+ * Revision-number index over the deltas of one master: an
+ * open-addressed table, a power of two in size and at most half
+ * full, keyed on the interned number.
+ */
+typedef struct _nodehash {
+	Node **table;
+	int size;
+	int entries;
+	arena nodes;
+	Node *head_node;
+	unsigned long lookups;	/* probe statistics */
+	unsigned long probes;
+	int max_probe;
+} nodehash;
+
 typedef struct _cvs_symbol {
     struct _cvs_symbol	*next;
     char		*name;
-    cvs_number		number;
+    cvs_number		*number;
 } cvs_symbol;
 
 typedef struct _cvs_branch {
     struct _cvs_branch	*next;
-    cvs_number		number;
+    cvs_number		*number;
     Node		*node;
 } cvs_branch;
 
 typedef struct _cvs_version {
     struct _cvs_version	*next;
-    cvs_number		number;
+    cvs_number		*number;
     time_t		date;
     char		*author;
     char		*state;
     bool		dead;
     cvs_branch		*branches;
-    cvs_number		parent;	/* next in ,v file */
+    cvs_number		*parent;	/* next in ,v file */
     char		*commitid;
     Node		*node;
 } cvs_version;
 
+/*
+ * Delta text is not copied out of the master; this locates the body
+ * of its @-string within the in-core image of the file.  The closing
+ * @ immediately follows the body.
+ */
+typedef struct _cvs_text {
+    size_t		offset;
+    size_t		length;
+} cvs_text;
+
 typedef struct _cvs_patch {
     struct _cvs_patch	*next;
-    cvs_number		number;
+    cvs_number		*number;
     char		*log;
-    char		*text;
+    cvs_text		text;
     Node		*node;
 } cvs_patch;
 
-
 typedef struct {
     char		*name;
-    cvs_number		head;
-    cvs_number		branch;
+    cvs_number		*head;
+    cvs_number		*branch;
     cvs_symbol		*symbols;
     cvs_version		*versions;
     cvs_patch		*patches;
@@ -108,22 +177,38 @@ typedef struct {
     int			nversions;
     char 		*expand;
 	char		*description;
+    char		*map;		/* in-core image of the master */
+    size_t		mapsize;
+    bool		mapped;		/* image is mmap()ed rather than read */
+    bool		headers_only;	/* delta text isn't wanted */
+    nodehash		nodehash;
+    arena		arena;		/* cvs_* structures come from here */
+    time_t		skew_vulnerable;
 } cvs_file;
 
 typedef struct _rev_file {
     char		*name;
-    cvs_number		number;
+    cvs_number		*number;
     time_t		date;
     int                 serial;
     mode_t		mode;
-    struct _rev_file	*link;
+    uint32_t		index;		/* slot in rev_files */
+    uint32_t		dir;		/* directory run, see revdir.c */
 } rev_file;
 
 typedef struct _rev_dir {
     int			nfiles;
-    rev_file		*files[0];
+    uint32_t		files[0];	/* rev_files indices */
 } rev_dir;
 
+extern rev_file	**rev_files;
+
+#define rev_dir_file(d,i)	(rev_files[(d)->files[i]])
+
+typedef struct _rev_tree rev_tree;
+
+typedef struct _rev_dir_set rev_dir_set;
+
 extern time_t	time_now;
 
 extern int commit_time_window;
@@ -140,23 +225,26 @@ extern bool suppress_keyword_expansion;
 
 extern char *branch_prefix;
 
+/*
+ * The fields the merge and locate loops look at come first, so a
+ * step along a branch touches one cache line.  The commits of a
+ * branch read from a master are allocated together, newest first,
+ * so following parent pointers walks forward through memory.
+ */
 typedef struct _rev_commit {
     struct _rev_commit	*parent;
-    char		tail;
-    char		seen;
-    char		used;
-    bool		tailed;
-    bool		tagged;
     time_t		date;
+    rev_file		*file;		/* first file */
+    char		*commitid;
     char		*log;
     char		*author;
-    char		*commitid;
-    int                 serial;
-    struct _rev_commit	*user;
-    rev_file		*file;		/* first file */
     int			nfiles;
-    int			ndirs;
-    rev_dir		*dirs[0];
+    char		tail;
+    char		seen;
+    bool		tagged;
+    /* export only */
+    int                 serial;
+    rev_tree		*tree;		/* files, see revdir.c */
 } rev_commit;
 
 typedef struct _rev_ref {
@@ -166,15 +254,27 @@ typedef struct _rev_ref {
     int			tail;
     int			degree;	/* number of digits in original CVS version */
     int			depth;	/* depth in branching tree (1 is trunk) */
-    cvs_number		number;
+    cvs_number		*number;
     char		*name;
     bool		shown;
 } rev_ref;
 
+/* a tag found while reading a master, held until the tag table is safe to update */
+typedef struct _rev_tag {
+    struct _rev_tag	*next;
+    rev_commit		*commit;
+    char		*name;
+} rev_tag;
+
 typedef struct _rev_list {
     struct _rev_list	*next;
     rev_ref	*heads;
     int		watch;
+    rev_tag	*tags;		/* pending tags, newest first */
+    arena	commits;	/* a master's commits live here */
+    arena	filerevs;	/* and its rev_files here */
+    rev_file	**files;	/* its live file revisions, by number */
+    int		nfiles;
 } rev_list;
 
 typedef struct _rev_file_list {
@@ -201,29 +301,33 @@ cvs_author * fullname (char *);
 
 int load_author_map (char *);
 
-extern cvs_file     *this_file;
-
-int yyparse (void);
+int yyparse (void *scanner, cvs_file *cvsfile);
 
-extern char *yyfilename;
+#define CTIME_LEN	26	/* room ctime_r() needs */
 
 char *
-ctime_nonl (time_t *date);
+ctime_nonl (time_t *date, char *buf);
 
 cvs_number
 lex_number (char *);
 
 time_t
-lex_date (cvs_number *n);
+lex_date (cvs_number *n, void *scanner);
 
 char *
-lex_text (void);
+lex_text (void *scanner);
+
+void *
+lex_init (cvs_file *cvs);
+
+void
+lex_free (void *scanner);
 
 rev_list *
 rev_list_cvs (cvs_file *cvs);
 
 rev_list *
-rev_list_merge (rev_list *lists);
+rev_list_merge (rev_list *lists, int nthreads);
 
 void
 rev_list_free (rev_list *rl, int free_files);
@@ -248,7 +352,9 @@ typedef struct _tag {
 } Tag;
 
 extern Tag *all_tags;
-void tag_commit(rev_commit *c, char *name);
+void tag_commit(rev_commit *c, char *name, char *filename);
+void tag_queue(rev_list *rl, rev_commit *c, char *name);
+void tag_flush(rev_list *rl, char *filename);
 rev_commit **tagged(Tag *tag);
 void discard_tags(void);
 
@@ -291,12 +397,24 @@ cvs_is_trunk (cvs_number *number);
 int
 cvs_is_vendor (cvs_number *number);
 
+void *
+arena_alloc (arena *a, size_t size);
+
+void *
+arena_alloc_array (arena *a, size_t n, size_t size);
+
+void
+arena_free (arena *a);
+
 void
 cvs_file_free (cvs_file *cvs);
 
 char *
 cvs_number_string (cvs_number *n, char *str);
 
+time_t
+cvs_number_date (cvs_number *n);
+
 long
 time_compare (time_t a, time_t b);
 
@@ -304,7 +422,8 @@ void
 dump_ref_name (FILE *f, rev_ref *ref);
 
 char *
-stringify_revision (char *name, char *sep, cvs_number *number);
+stringify_revision (char *name, char *sep, cvs_number *number,
+		    char *result, size_t size);
 
 void
 dump_number_file (FILE *f, char *name, cvs_number *number);
@@ -336,14 +455,27 @@ dump_rev_graph (rev_list *rl, char *title);
 void
 dump_rev_tree (rev_list *rl);
 
-extern int yylex (void);
-
 char *
 atom (char *string);
 
+cvs_number *
+atom_cvs_number (cvs_number *n);
+
+cvs_number *
+cvs_number_prefix (cvs_number *n, int depth);
+
 void
 discard_atoms (void);
 
+void
+atom_report (FILE *f);
+
+void
+mem_charge (enum mem_kind kind, long objects, long bytes);
+
+void
+mem_report (FILE *f, char *when);
+
 rev_ref *
 rev_list_add_head (rev_list *rl, rev_commit *commit, char *name, int degree);
 
@@ -362,12 +494,6 @@ rev_diff_free (rev_diff *d);
 rev_ref *
 rev_branch_of_commit (rev_list *rl, rev_commit *commit);
 
-rev_file *
-rev_file_rev (char *name, cvs_number *n, time_t date);
-
-void
-rev_file_free (rev_file *f);
-
 void
 rev_head_free (rev_ref *heads, int free_files);
 
@@ -402,8 +528,32 @@ free_author_map (void);
 
 void generate_files(cvs_file *cvs, void (*hook)(Node *node, void *buf, unsigned long len));
 
+void
+rev_dir_runs (rev_file **files, uint32_t nfile);
+
+rev_tree *
+rev_pack_files (uint32_t *files, int nfiles);
+
 rev_dir **
-rev_pack_files (rev_file **files, int nfiles, int *ndr);
+rev_tree_dirs (rev_tree *tree, int *ndirs);
+
+bool
+rev_tree_has_file (rev_tree *tree, rev_file *f);
+
+rev_dir_set *
+rev_dir_set_new (void);
+
+void
+rev_dir_set_free (rev_dir_set *set);
+
+void
+rev_dir_set_clear (rev_dir_set *set);
+
+void
+rev_dir_set_change (rev_dir_set *set, rev_file *old, rev_file *new);
+
+rev_tree *
+rev_dir_set_pack (rev_dir_set *set, int *nfiles);
 
 void
 rev_free_dirs (void);
@@ -411,6 +561,27 @@ rev_free_dirs (void);
 void
 rev_commit_cleanup (void);
 
+typedef struct _walk_file {
+    char	*name;
+    off_t	size;		/* -1 unless asked for, or stat()ed */
+} walk_file;
+
+walk_file *
+walk_tree (char *root, int nthreads, bool sizes, int *nfiles);
+
+const char *
+scan_at (const char *p, const char *end);
+
+/*
+ * scan_line() reads whole aligned blocks around p, so a buffer
+ * handed to it must start SCAN_PAD-aligned and have SCAN_PAD
+ * readable bytes after its end.
+ */
+#define SCAN_PAD	32
+
+const char *
+scan_line (const char *p);
+
 void 
 load_status (char *name);
 
@@ -423,13 +594,10 @@ xmalloc(size_t size);
 void* 
 xrealloc(void *ptr, size_t size);
 
-void hash_version(cvs_version *);
-void hash_patch(cvs_patch *);
-void hash_branch(cvs_branch *);
-void clean_hash(void);
-void build_branches(void);
-extern Node *head_node;
-
-extern time_t skew_vulnerable;
+void hash_version(nodehash *, cvs_version *);
+void hash_patch(nodehash *, cvs_patch *);
+void hash_branch(nodehash *, cvs_branch *);
+void clean_hash(nodehash *);
+void build_branches(nodehash *);
 
 #endif /* _CVS_H_ */
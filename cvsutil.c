@@ -39,6 +39,8 @@ cvs_same_branch (cvs_number *a, cvs_number *b)
     int		n;
     int		an, bn;
 
+    if (a == b)
+	return 1;
     if (a->c & 1) {
 	t = *a;
 	t.n[t.c++] = 0;
@@ -80,6 +82,8 @@ cvs_number_compare (cvs_number *a, cvs_number *b)
     int n = min (a->c, b->c);
     int i;
 
+    if (a == b)
+	return 0;
     for (i = 0; i < n; i++) {
 	if (a->n[i] < b->n[i])
 	    return -1;
@@ -189,9 +193,9 @@ cvs_branch_head (cvs_file *f, cvs_number *branch)
 	n.c--;
     }
     for (v = f->versions; v; v = v->next) {
-	if (cvs_same_branch (&n, &v->number) &&
-	    cvs_number_compare (&n, &v->number) > 0)
-	    n = v->number;
+	if (cvs_same_branch (&n, v->number) &&
+	    cvs_number_compare (&n, v->number) > 0)
+	    n = *v->number;
     }
     return n;
 }
@@ -206,10 +210,10 @@ cvs_branch_parent (cvs_file *f, cvs_number *branch)
     n = *branch;
     n.n[n.c-1] = 0;
     for (v = f->versions; v; v = v->next) {
-	if (cvs_same_branch (&n, &v->number) &&
-	    cvs_number_compare (branch, &v->number) < 0 &&
-	    cvs_number_compare (&n, &v->number) >= 0)
-	    n = v->number;
+	if (cvs_same_branch (&n, v->number) &&
+	    cvs_number_compare (branch, v->number) < 0 &&
+	    cvs_number_compare (&n, v->number) >= 0)
+	    n = *v->number;
     }
     return n;
 }
@@ -222,9 +226,9 @@ cvs_find_version (cvs_file *cvs, cvs_number *number)
     cvs_version	*nv = NULL;
 
     for (cv = cvs->versions; cv; cv = cv->next) {
-	if (cvs_same_branch (number, &cv->number) &&
-	    cvs_number_compare (&cv->number, number) > 0 &&
-	    (!nv || cvs_number_compare (&nv->number, &cv->number) > 0))
+	if (cvs_same_branch (number, cv->number) &&
+	    cvs_number_compare (cv->number, number) > 0 &&
+	    (!nv || cvs_number_compare (nv->number, cv->number) > 0))
 	    nv = cv;
     }
     return nv ? nv->node : NULL;
@@ -254,65 +258,72 @@ cvs_is_vendor (cvs_number *number)
     return 1;
 }
 
-static void
-cvs_symbol_free (cvs_symbol *symbol)
-/* discard a symbol and its storage */
-{
-    cvs_symbol	*s;
+#define ARENA_MIN_BLOCK	4096
+#define ARENA_MAX_BLOCK	(1 << 20)
 
-    while ((s = symbol)) {
-	symbol = s->next;
-	free (s);
-    }
-}
-
-static void
-cvs_branch_free (cvs_branch *branch)
-/* discard a branch and its storage */
+void *
+arena_alloc_array (arena *a, size_t n, size_t size)
+/* hand out zeroed storage for n objects that lives until arena_free() */
 {
-    cvs_branch	*b;
-
-    while ((b = branch)) {
-	branch = b->next;
-	free (b);
+    arena_block	*b = a->blocks;
+    size_t	bsize;
+    void	*p;
+
+    size = (n * size + 7) & ~(size_t) 7;
+    if (!b || b->size - b->used < size) {
+	bsize = b ? b->size * 2 : ARENA_MIN_BLOCK;
+	if (bsize > ARENA_MAX_BLOCK)
+	    bsize = ARENA_MAX_BLOCK;
+	if (bsize < size)
+	    bsize = size;
+	b = xmalloc (sizeof (arena_block) + bsize);
+	b->size = bsize;
+	b->used = 0;
+	b->next = a->blocks;
+	a->blocks = b;
+	a->nblocks++;
+	if (mem_stats)
+	    mem_charge (a->kind, 0, sizeof (arena_block) + bsize);
     }
+    p = b->data + b->used;
+    b->used += size;
+    a->nalloc += n;
+    if (mem_stats)
+	mem_charge (a->kind, n, 0);
+    memset (p, 0, size);
+    return p;
 }
 
-static void
-cvs_version_free (cvs_version *version)
-/* discard a version and its storage */
+void *
+arena_alloc (arena *a, size_t size)
+/* hand out zeroed storage that lives until arena_free() */
 {
-    cvs_version	*v;
-
-    while ((v = version)) {
-	version = v->next;
-	cvs_branch_free (v->branches);
-	free (v);
-    }
+    return arena_alloc_array (a, 1, size);
 }
 
-static void
-cvs_patch_free (cvs_patch *patch)
-/* discard a patch and its storage */
+void
+arena_free (arena *a)
+/* release everything an arena has handed out */
 {
-    cvs_patch	*v;
+    arena_block	*b;
+    long	bytes = 0;
 
-    while ((v = patch)) {
-	patch = v->next;
-	free (v->text);
-	free (v);
+    while ((b = a->blocks)) {
+	a->blocks = b->next;
+	bytes += sizeof (arena_block) + b->size;
+	free (b);
     }
+    mem_charge (a->kind, -(long) a->nalloc, -bytes);
+    a->nalloc = a->nblocks = 0;
 }
 
 void
 cvs_file_free (cvs_file *cvs)
 /* discard a file object and its storage */
 {
-    cvs_symbol_free (cvs->symbols);
-    cvs_version_free (cvs->versions);
-    cvs_patch_free (cvs->patches);
+    arena_free (&cvs->arena);
+    clean_hash (&cvs->nodehash);
     free (cvs);
-    clean_hash();
 }
 
 char *
@@ -332,4 +343,46 @@ cvs_number_string (cvs_number *n, char *str)
     return str;
 }
 
+static time_t
+cvs_days (long y, long m, long d)
+/*
+ * Days from 1970-01-01 to a proleptic Gregorian date, counting
+ * years from March so the leap day falls at the end.
+ */
+{
+	long	era, yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+time_t
+cvs_number_date (cvs_number *n)
+/*
+ * RCS dates are UTC, so there's no need to go through mktime()
+ * and its time zone lock; out-of-range fields carry over the same
+ * way.  Two-digit years are 19xx.
+ */
+{
+	long		year, mon;
+	time_t		d;
+
+	year = n->n[0];
+	if (year <= 1900)
+	   year += 1900;
+	mon = n->n[1] - 1;
+	year += mon / 12;
+	mon %= 12;
+	if (mon < 0) {
+	    mon += 12;
+	    year--;
+	}
+	d = cvs_days (year, mon + 1, 1) + n->n[2] - 1;
+	return ((d * 24 + n->n[3]) * 60 + n->n[4]) * 60 + n->n[5];
+}
+
 /* end */
@@ -0,0 +1,157 @@
+/*
+ * Benchmark for cvs_number_date() against the mktime() conversion
+ * lex_date() used before it.
+ *
+ * The corpus holds every two-digit year with every month and day,
+ * and then random dates from 1900 to 2199 written both ways, with
+ * fields pushed out of range now and then as a damaged master might
+ * have them.  Each date must convert to the same time both ways,
+ * or the run fails; then each conversion is timed over the corpus.
+ *
+ * usage: datebench [-d dates] [-n rounds]
+ */
+
+#include "cvs.h"
+
+/* generate.o wants this from main.c */
+bool suppress_keyword_expansion = false;
+
+static time_t
+mktime_date (cvs_number *n)
+/* lex_date() as it was, by way of mktime() with TZ set to UTC */
+{
+	struct tm	tm;
+
+	tm.tm_year = n->n[0];
+	if (tm.tm_year > 1900)
+	   tm.tm_year -= 1900;
+	tm.tm_mon = n->n[1] - 1;
+	tm.tm_mday = n->n[2];
+	tm.tm_hour = n->n[3];
+	tm.tm_min = n->n[4];
+	tm.tm_sec = n->n[5];
+	tm.tm_isdst = 0;
+	#ifndef __CYGWIN__
+	tm.tm_zone = 0;
+	#endif
+	return mktime (&tm);
+}
+
+static cvs_number	*dates;
+static int		ndates;
+
+static void
+make_date (int year, int mon, int day, int hour, int min, int sec)
+{
+    cvs_number	*n = &dates[ndates++];
+
+    n->c = 6;
+    n->n[0] = year;
+    n->n[1] = mon;
+    n->n[2] = day;
+    n->n[3] = hour;
+    n->n[4] = min;
+    n->n[5] = sec;
+}
+
+static unsigned	seed = 1;
+
+static int
+rnd (int n)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % n;
+}
+
+static void
+make_dates (int nrandom)
+{
+    int		y, m, d, year;
+
+    dates = xmalloc ((100 * 12 * 31 + nrandom) * sizeof (cvs_number));
+    for (y = 0; y < 100; y++)
+	for (m = 1; m <= 12; m++)
+	    for (d = 1; d <= 31; d++)
+		make_date (y, m, d, y % 24, (m * 7) % 60, (d * 13) % 60);
+
+    while (ndates < 100 * 12 * 31 + nrandom) {
+	year = 1900 + rnd (300);
+	if (year < 2000 && rnd (2))
+	    year -= 1900;
+	if (rnd (16))
+	    make_date (year, 1 + rnd (12), 1 + rnd (31),
+		       rnd (24), rnd (60), rnd (60));
+	else
+	    make_date (year, rnd (14), rnd (33),
+		       rnd (25), rnd (61), rnd (62));
+    }
+}
+
+static double
+now (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main (int argc, char **argv)
+{
+    int		nrandom = 1000000, rounds = 5;
+    time_t	a, b, sum;
+    char	buf[CVS_MAX_REV_LEN + 1];
+    double	t;
+    int		c, i, r;
+
+    while ((c = getopt (argc, argv, "d:n:")) != -1) {
+	switch (c) {
+	case 'd':
+	    nrandom = atoi (optarg);
+	    break;
+	case 'n':
+	    rounds = atoi (optarg);
+	    break;
+	default:
+	    fprintf (stderr, "usage: datebench [-d dates] [-n rounds]\n");
+	    exit (1);
+	}
+    }
+    if (nrandom < 0 || rounds <= 0) {
+	fprintf (stderr, "usage: datebench [-d dates] [-n rounds]\n");
+	exit (1);
+    }
+    setenv ("TZ", "UTC", 1);
+    tzset ();
+    make_dates (nrandom);
+
+    for (i = 0; i < ndates; i++) {
+	a = mktime_date (&dates[i]);
+	b = cvs_number_date (&dates[i]);
+	if (a != b) {
+	    fprintf (stderr, "datebench: %s is %ld by mktime(), %ld here\n",
+		     cvs_number_string (&dates[i], buf), (long) a, (long) b);
+	    exit (1);
+	}
+    }
+    printf ("%d dates agree\n", ndates);
+
+    sum = 0;
+    t = now ();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < ndates; i++)
+	    sum += mktime_date (&dates[i]);
+    t = now () - t;
+    printf ("mktime()           %7.1f ns/date\n", t * 1e9 / ndates / rounds);
+
+    t = now ();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < ndates; i++)
+	    sum -= cvs_number_date (&dates[i]);
+    t = now () - t;
+    printf ("cvs_number_date()  %7.1f ns/date\n", t * 1e9 / ndates / rounds);
+
+    /* both passes cancel out, and keep the conversions from being dropped */
+    return sum != 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * Regression check for the directory runs of revdir.c.
+ *
+ * Each case is a list of master names in name order, as
+ * rev_list_index_files hands them over, and the number of
+ * directory runs they should make.  The runs are built, then all
+ * the files are packed into a tree and read back; every file must
+ * come back once, in order.  A tree of every other file is packed
+ * too, and rev_tree_has_file must find just those files in it.
+ * Absolute paths, from "find /cvsroot"
+ * or --root /cvsroot, and doubled slashes are among the cases;
+ * an alarm fails the run if building the runs doesn't finish.
+ *
+ * usage: dircheck
+ */
+
+#include "cvs.h"
+#include <signal.h>
+
+/* generate.o wants this from main.c */
+bool suppress_keyword_expansion = false;
+
+rev_file	**rev_files;
+
+struct dir_case {
+    const char	*names[8];
+    uint32_t	nruns;
+};
+
+static const struct dir_case cases[] = {
+    { { "a,v", "b,v" }, 1 },
+    { { "./m/a,v", "./m/b,v", "./n/c,v" }, 2 },
+    { { "/cvsroot/m/a,v" }, 1 },
+    { { "/a,v", "/cvsroot/m/a,v", "/cvsroot/m/b,v", "/cvsroot/n/c,v" }, 3 },
+    { { "/cvsroot/a,v", "/cvsroot/m/b,v", "/cvsroot/z,v" }, 3 },
+    { { "//cvsroot//m/a,v", "//cvsroot//m//b,v", "//cvsroot/n/c,v" }, 2 },
+    { { "m/a,v", "m//b,v", "m/n/c,v" }, 2 },
+};
+
+static void
+timeout (int sig)
+{
+    fprintf (stderr, "dircheck: building the directory runs didn't finish\n");
+    _exit (1);
+}
+
+static bool
+check_case (const struct dir_case *c)
+{
+    rev_file	*files;
+    uint32_t	*indices;
+    rev_dir	**rds;
+    rev_tree	*tree, *half;
+    uint32_t	nfile, nhalf, i, next = 0;
+    int		nds, d, f;
+    bool	ok = true;
+
+    for (nfile = 0; nfile < 8 && c->names[nfile]; nfile++)
+	;
+    files = xmalloc (nfile * sizeof (rev_file));
+    rev_files = xmalloc (nfile * sizeof (rev_file *));
+    indices = xmalloc (nfile * sizeof (uint32_t));
+    for (i = 0; i < nfile; i++) {
+	memset (&files[i], '\0', sizeof (rev_file));
+	files[i].name = (char *) c->names[i];
+	files[i].index = i;
+	rev_files[i] = &files[i];
+	indices[i] = i;
+    }
+
+    alarm (10);
+    rev_dir_runs (rev_files, nfile);
+    alarm (0);
+    if (files[nfile - 1].dir + 1 != c->nruns) {
+	fprintf (stderr, "dircheck: %s...: %u runs, expected %u\n",
+		 c->names[0], files[nfile - 1].dir + 1, c->nruns);
+	ok = false;
+    }
+
+    tree = rev_pack_files (indices, nfile);
+    rds = rev_tree_dirs (tree, &nds);
+    for (d = 0; d < nds; d++)
+	for (f = 0; f < rds[d]->nfiles; f++)
+	    if (rds[d]->files[f] != next++)
+		ok = false;
+    if (next != nfile)
+	ok = false;
+    if (!ok)
+	fprintf (stderr, "dircheck: %s...: files don't come back in order\n",
+		 c->names[0]);
+    for (i = 0; i < nfile; i++)
+	if (!rev_tree_has_file (tree, &files[i])) {
+	    fprintf (stderr, "dircheck: %s not found in the full tree\n",
+		     c->names[i]);
+	    ok = false;
+	}
+
+    for (i = 0, nhalf = 0; i < nfile; i += 2)
+	indices[nhalf++] = i;
+    half = rev_pack_files (indices, nhalf);
+    for (i = 0; i < nfile; i++)
+	if (rev_tree_has_file (half, &files[i]) != !(i % 2)) {
+	    fprintf (stderr, "dircheck: %s %sfound in the half tree\n",
+		     c->names[i], i % 2 ? "" : "not ");
+	    ok = false;
+	}
+
+    free (rds);
+    rev_free_dirs ();
+    free (indices);
+    free (rev_files);
+    free (files);
+    return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+    size_t	i;
+    int		failed = 0;
+
+    signal (SIGALRM, timeout);
+    for (i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+	if (!check_case (&cases[i]))
+	    failed++;
+    if (failed) {
+	fprintf (stderr, "dircheck: %d of %lu cases failed\n",
+		 failed, (unsigned long) (sizeof (cases) / sizeof (cases[0])));
+	return 1;
+    }
+    printf ("dircheck: %lu cases passed\n",
+	    (unsigned long) (sizeof (cases) / sizeof (cases[0])));
+    return 0;
+}
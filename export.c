@@ -19,6 +19,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include "cvs.h"
 
 /*
@@ -36,6 +37,8 @@ struct mark {
 static struct mark *markmap;
 static int seqno, mark;
 static char blobdir[PATH_MAX];
+/* export_blob() is called from the loader threads */
+static pthread_mutex_t seqno_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void export_init(void)
 {
@@ -44,11 +47,10 @@ void export_init(void)
     mkdir(blobdir, 0770);
 }
 
-static char *blobfile(int m)
+static char *blobfile(int m, char *path)
 /* Random-access location of the blob corresponding to the specified serial */
 {
-    static char path[PATH_MAX];
-    (void)snprintf(path, sizeof(path), "%s/%d", blobdir, m);
+    (void)snprintf(path, PATH_MAX, "%s/%d", blobdir, m);
     return path;
 }
 
@@ -56,15 +58,21 @@ void export_blob(Node *node, void *buf, unsigned long len)
 /* save the blob where it will be available for random access */
 {
     FILE *wfp;
-    
-    node->file->serial = ++seqno;
+    char path[PATH_MAX];
+    int serial, header;
+
+    pthread_mutex_lock(&seqno_mutex);
+    serial = ++seqno;
+    pthread_mutex_unlock(&seqno_mutex);
+    node->file->serial = serial;
 
-    wfp = fopen(blobfile(seqno), "w");
+    wfp = fopen(blobfile(serial, path), "w");
     assert(wfp);
-    fprintf(wfp, "data %zd\n", len);
+    header = fprintf(wfp, "data %zd\n", len);
     fwrite(buf, len, sizeof(char), wfp);
     fputc('\n', wfp);
     (void)fclose(wfp);
+    mem_charge(MEM_SPOOL, 1, header + len + 1);
 }
 
 static void drop_path_component(char *string, const char *drop)
@@ -205,6 +213,8 @@ static void export_commit(rev_commit *commit, char *branch, int strip)
     time_t ct;
     rev_file	*f, *f2;
     int		i, j, i2, j2;
+    rev_dir	**dirs, **pdirs;
+    int		ndirs, npdirs;
     struct fileop *operations, *op, *op2;
     int noperations;
 
@@ -216,21 +226,23 @@ static void export_commit(rev_commit *commit, char *branch, int strip)
 
     noperations = OP_CHUNK;
     op = operations = xmalloc(sizeof(struct fileop) * noperations);
-    for (i = 0; i < commit->ndirs; i++) {
-	rev_dir	*dir = commit->dirs[i];
+    dirs = rev_tree_dirs(commit->tree, &ndirs);
+    pdirs = commit->parent ? rev_tree_dirs(commit->parent->tree, &npdirs) : NULL;
+    for (i = 0; i < ndirs; i++) {
+	rev_dir	*dir = dirs[i];
 	
 	for (j = 0; j < dir->nfiles; j++) {
 	    char *stripped;
 	    bool present, changed;
-	    f = dir->files[j];
+	    f = rev_dir_file (dir, j);
 	    stripped = export_filename(f, strip);
 	    present = false;
 	    changed = false;
 	    if (commit->parent) {
-		for (i2 = 0; i2 < commit->parent->ndirs; i2++) {
-		    rev_dir	*dir2 = commit->parent->dirs[i2];
+		for (i2 = 0; i2 < npdirs; i2++) {
+		    rev_dir	*dir2 = pdirs[i2];
 		    for (j2 = 0; j2 < dir2->nfiles; j2++) {
-			f2 = dir2->files[j2];
+			f2 = rev_dir_file (dir2, j2);
 			if (strcmp(f->name, f2->name) == 0) {
 			    present = true;
 			    changed = (f->serial != f2->serial);
@@ -262,7 +274,9 @@ static void export_commit(rev_commit *commit, char *branch, int strip)
 		}
 
 		if (revision_map || reposurgeon) {
-		    char *fr = stringify_revision(stripped, " ", &f->number);
+		    char frbuf[BUFSIZ];
+		    char *fr = stringify_revision(stripped, " ", f->number,
+						  frbuf, sizeof(frbuf));
 		    if (revision_map)
 			fprintf(revision_map, "%s :%d\n", fr, markmap[f->serial].external);
 		    if (reposurgeon)
@@ -284,17 +298,17 @@ static void export_commit(rev_commit *commit, char *branch, int strip)
 
     if (commit->parent)
     {
-	for (i = 0; i < commit->parent->ndirs; i++) {
-	    rev_dir	*dir = commit->parent->dirs[i];
+	for (i = 0; i < npdirs; i++) {
+	    rev_dir	*dir = pdirs[i];
 
 	    for (j = 0; j < dir->nfiles; j++) {
 		bool present;
-		f = dir->files[j];
+		f = rev_dir_file (dir, j);
 		present = false;
-		for (i2 = 0; i2 < commit->ndirs; i2++) {
-		    rev_dir	*dir2 = commit->dirs[i2];
+		for (i2 = 0; i2 < ndirs; i2++) {
+		    rev_dir	*dir2 = dirs[i2];
 		    for (j2 = 0; j2 < dir2->nfiles; j2++) {
-			f2 = dir2->files[j2];
+			f2 = rev_dir_file (dir2, j2);
 			if (strcmp(f->name, f2->name) == 0) {
 			    present = true;
 			}
@@ -321,21 +335,28 @@ static void export_commit(rev_commit *commit, char *branch, int strip)
 	    }
 	}
     }
+    free(dirs);
+    free(pdirs);
 
     for (op2 = operations; op2 < op; op2++)
     {
 	if (op2->op == 'M' && !markmap[op2->serial].emitted)
 	{
-	    char *fn = blobfile(op2->serial);
+	    char path[PATH_MAX];
+	    char *fn = blobfile(op2->serial, path);
 	    FILE *rfp = fopen(fn, "r");
 	    if (rfp)
 	    {
 		int c;
+		long size = 0;
 		markmap[op2->serial].external = ++mark; 
 		printf("blob\nmark :%d\n", mark);
-		while ((c = fgetc(rfp)) != EOF)
+		while ((c = fgetc(rfp)) != EOF) {
 		    putchar(c);
+		    size++;
+		}
 		(void) unlink(fn);
+		mem_charge(MEM_SPOOL, -1, -size);
 		markmap[op2->serial].emitted = true;
 		(void)fclose(rfp);
 	    }
@@ -424,6 +445,7 @@ bool export_commits(rev_list *rl, int strip)
     extent = sizeof(struct mark) * (seqno + export_total_commits + 1);
     markmap = (struct mark *)xmalloc(extent);
     memset(markmap, '\0', extent);
+    mem_charge(MEM_MARKMAP, seqno + export_total_commits + 1, extent);
     export_current_commit = 0;
     for (h = rl->heads; h; h = h->next) {
 	export_current_head = h->name;
@@ -466,6 +488,7 @@ bool export_commits(rev_list *rl, int strip)
 	       markmap[h->commit->serial].external);
     }
     fprintf (STATUS, "\n");
+    mem_charge(MEM_MARKMAP, -(long)(extent / sizeof(struct mark)), -(long)extent);
     free(markmap);
     return true;
 }
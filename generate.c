@@ -68,19 +68,12 @@ enum markers { Nomatch, Author, Date, Header, Id, Locker, Log,
 enum stringwork {ENTER, EDIT};
 
 enum expand_mode {EXPANDKKV, EXPANDKKVL, EXPANDKK, EXPANDKV, EXPANDKO, EXPANDKB};
-enum expand_mode Gexpand;
-char * Glog;
-int Gkvlen = 0;
-char* Gkeyval = NULL;
-char const *Gfilename;
-char *Gabspath;
-cvs_version *Gversion;
-char Gversion_number[CVS_MAX_REV_LEN];
-struct out_buffer_type *Goutbuf;
-struct in_buffer_type in_buffer_store;
-struct in_buffer_type *Ginbuf = &in_buffer_store;
 
 /*
+ * All the state of checking out one master.  Each call of
+ * generate_files() gets its own, so files can be expanded
+ * concurrently.
+ *
  * Gline contains pointers to the lines in the currently edit buffer
  * It is a 0-origin array that represents Glinemax-Ggapsize lines.
  * Gline[0 .. Ggap-1] and Gline[Ggap+Ggapsize .. Glinemax-1] hold
@@ -88,17 +81,32 @@ struct in_buffer_type *Ginbuf = &in_buffer_store;
  * Any @s in lines are duplicated.
  * Lines are terminated by \n, or (for a last partial line only) by single @.
  */
-static int depth;
-static struct {
-	Node *next_branch;
-	Node *node;
-	uchar **line;
-	size_t gap, gapsize, linemax;
-} stack[CVS_MAX_DEPTH/2];
-#define Gline stack[depth].line
-#define Ggap stack[depth].gap
-#define Ggapsize stack[depth].gapsize
-#define Glinemax stack[depth].linemax
+typedef struct _editbuffer {
+	enum expand_mode Gexpand;
+	char *Glog;
+	int Gkvlen;
+	char *Gkeyval;
+	char const *Gfilename;
+	uchar *Gmap;	/* in-core image of the master, holding the delta texts */
+	char *Gabspath;
+	cvs_version *Gversion;
+	char Gversion_number[CVS_MAX_REV_LEN];
+	struct out_buffer_type *Goutbuf;
+	struct in_buffer_type in_buffer_store;
+	struct in_buffer_type *Ginbuf;
+	int depth;
+	struct {
+		Node *next_branch;
+		Node *node;
+		uchar **line;
+		size_t gap, gapsize, linemax;
+	} stack[CVS_MAX_DEPTH/2];
+} editbuffer_t;
+
+#define Gline(eb) eb->stack[eb->depth].line
+#define Ggap(eb) eb->stack[eb->depth].gap
+#define Ggapsize(eb) eb->stack[eb->depth].gapsize
+#define Glinemax(eb) eb->stack[eb->depth].linemax
 
 static void fatal_system_error(char const *s)
 {
@@ -141,134 +149,147 @@ void* xrealloc(void *ptr, size_t size)
 /* backup one position in the input buffer, unless at start of buffer
  *   return character at new position, or EOF if we could not back up
  */
-static int in_buffer_ungetc(void)
+static int in_buffer_ungetc(editbuffer_t *eb)
 {
 	int c;
-	if (Ginbuf->read_count == 0)
+	if (eb->Ginbuf->read_count == 0)
 		return EOF;
-	--Ginbuf->read_count;
-	--Ginbuf->ptr;
-	c = *Ginbuf->ptr;
+	--eb->Ginbuf->read_count;
+	--eb->Ginbuf->ptr;
+	c = *eb->Ginbuf->ptr;
 	if (c == SDELIM) {
-		--Ginbuf->ptr;
-		c = *Ginbuf->ptr;
+		--eb->Ginbuf->ptr;
+		c = *eb->Ginbuf->ptr;
 	}
 	return c;
 }
 
-static int in_buffer_getc(void)
+static int in_buffer_getc(editbuffer_t *eb)
 {
 	int c;
-	c = *(Ginbuf->ptr++);
-	++Ginbuf->read_count;
+	c = *(eb->Ginbuf->ptr++);
+	++eb->Ginbuf->read_count;
 	if (c == SDELIM) {
-		c = *(Ginbuf->ptr++);
+		c = *(eb->Ginbuf->ptr++);
 		if (c != SDELIM) {
-			Ginbuf->ptr -= 2;
-			--Ginbuf->read_count;
+			eb->Ginbuf->ptr -= 2;
+			--eb->Ginbuf->read_count;
 			return EOF;
 		}
 	}
 	return c ;
 }
 
-static uchar * in_get_line(void)
+static uchar * in_get_line(editbuffer_t *eb)
 {
-	int c;
-	uchar *ptr = Ginbuf->ptr;
-	c=in_buffer_getc();
-	if (c == EOF)
+	uchar *ptr = eb->Ginbuf->ptr, *p = ptr;
+	int escapes = 0;
+
+	/* step over clean runs in bulk; only an @ needs a closer look */
+	for (;;) {
+		p = (uchar *)scan_line((const char *)p);
+		if (*p == '\n') {
+			p++;
+			break;
+		}
+		if (p[1] != SDELIM)
+			break;
+		p += 2;
+		escapes++;
+	}
+	if (p == ptr)
 		return NULL;
-	while (c != EOF && c != '\n')
-		c = in_buffer_getc();
+	eb->Ginbuf->read_count += p - ptr - escapes;
+	eb->Ginbuf->ptr = p;
 	return ptr;
 }
 
-static uchar * in_buffer_loc(void)
+static uchar * in_buffer_loc(editbuffer_t *eb)
 {
-	return(Ginbuf->ptr);
+	return(eb->Ginbuf->ptr);
 }
 
-static void in_buffer_init(uchar *text, int bypass_initial)
+/* start reading at text, which runs to an unescaped @ */
+static void in_buffer_init(editbuffer_t *eb, uchar *text)
 {
-	Ginbuf->ptr = Ginbuf->buffer = text;
-	Ginbuf->read_count=0;
-	if (bypass_initial && *Ginbuf->ptr++ != SDELIM)
-		fatal_error("Illegal buffer, missing @ %s", text);
+	eb->Ginbuf->ptr = eb->Ginbuf->buffer = text;
+	eb->Ginbuf->read_count=0;
 }
 
-static void out_buffer_init(void)
+static void out_buffer_init(editbuffer_t *eb)
 {
 	char *t;
-	Goutbuf = xmalloc(sizeof(struct out_buffer_type));
-	memset(Goutbuf, 0, sizeof(struct out_buffer_type));
-	Goutbuf->size = initial_out_buffer_size;
-	t = xmalloc(Goutbuf->size);
-	Goutbuf->text = t;
-	Goutbuf->ptr = t;
-	Goutbuf->end_of_text = t + Goutbuf->size;
+	eb->Goutbuf = xmalloc(sizeof(struct out_buffer_type));
+	memset(eb->Goutbuf, 0, sizeof(struct out_buffer_type));
+	eb->Goutbuf->size = initial_out_buffer_size;
+	t = xmalloc(eb->Goutbuf->size);
+	eb->Goutbuf->text = t;
+	eb->Goutbuf->ptr = t;
+	eb->Goutbuf->end_of_text = t + eb->Goutbuf->size;
 }
 
-static void out_buffer_enlarge(void)
+static void out_buffer_enlarge(editbuffer_t *eb)
 {
-	int ptroffset = Goutbuf->ptr - Goutbuf->text;
-	Goutbuf->size *= 2;
-	Goutbuf->text = xrealloc(Goutbuf->text, Goutbuf->size);
-	Goutbuf->end_of_text = Goutbuf->text + Goutbuf->size;
-	Goutbuf->ptr = Goutbuf->text + ptroffset;
+	int ptroffset = eb->Goutbuf->ptr - eb->Goutbuf->text;
+	eb->Goutbuf->size *= 2;
+	eb->Goutbuf->text = xrealloc(eb->Goutbuf->text, eb->Goutbuf->size);
+	eb->Goutbuf->end_of_text = eb->Goutbuf->text + eb->Goutbuf->size;
+	eb->Goutbuf->ptr = eb->Goutbuf->text + ptroffset;
 }
 
-static unsigned long  out_buffer_count(void)
+static unsigned long  out_buffer_count(editbuffer_t *eb)
 {
-	return (unsigned long) (Goutbuf->ptr - Goutbuf->text);
+	return (unsigned long) (eb->Goutbuf->ptr - eb->Goutbuf->text);
 }
 
-static char *out_buffer_text(void)
+static char *out_buffer_text(editbuffer_t *eb)
 {
-	return Goutbuf->text;
+	return eb->Goutbuf->text;
 }
 
-static void out_buffer_cleanup(void)
+static void out_buffer_cleanup(editbuffer_t *eb)
 {
-	free(Goutbuf->text);
-	free(Goutbuf);
+	free(eb->Goutbuf->text);
+	free(eb->Goutbuf);
 }
 
-inline static void out_putc(int c)
+inline static void out_putc(editbuffer_t *eb, int c)
 {
-	*Goutbuf->ptr++ = c;
-	if (Goutbuf->ptr >= Goutbuf->end_of_text)
-		out_buffer_enlarge();
+	*eb->Goutbuf->ptr++ = c;
+	if (eb->Goutbuf->ptr >= eb->Goutbuf->end_of_text)
+		out_buffer_enlarge(eb);
 }
 
-static void out_printf(const char *fmt, ...)
+static void out_printf(editbuffer_t *eb, const char *fmt, ...)
 {
 	int ret, room;
 	va_list ap;
 	while (1) {
-		room = Goutbuf->end_of_text - Goutbuf->ptr;
+		room = eb->Goutbuf->end_of_text - eb->Goutbuf->ptr;
 		va_start(ap, fmt);
-		ret = vsnprintf(Goutbuf->ptr, room, fmt, ap);
+		ret = vsnprintf(eb->Goutbuf->ptr, room, fmt, ap);
 		va_end(ap);
 		if (ret > -1 && ret < room) {
-			Goutbuf->ptr += ret;
+			eb->Goutbuf->ptr += ret;
 			return;
 		}
-		out_buffer_enlarge();
+		out_buffer_enlarge(eb);
 	}
 }
 
-static int out_fputs(const char *s)
+static int out_fputs(editbuffer_t *eb, const char *s)
 {
 	while (*s)
-		out_putc(*s++);
+		out_putc(eb, *s++);
 	return 0;
 }
 
-static void out_awrite(char const *s, size_t len)
+static void out_awrite(editbuffer_t *eb, char const *s, size_t len)
 {
-	while (len--)
-		out_putc(*s++);
+	while ((size_t)(eb->Goutbuf->end_of_text - eb->Goutbuf->ptr) <= len)
+		out_buffer_enlarge(eb);
+	memcpy(eb->Goutbuf->ptr, s, len);
+	eb->Goutbuf->ptr += len;
 }
 
 static int latin1_alpha(int c)
@@ -305,7 +326,7 @@ static char const * basefilename(char const *p)
 }
 
 /* Convert relative RCS filename to absolute path */
-static char const * getfullRCSname(void)
+static char const * getfullRCSname(editbuffer_t *eb)
 {
 	char *wdbuf = NULL;
 	int wdbuflen = 0;
@@ -315,12 +336,12 @@ static char const * getfullRCSname(void)
 	char const *r;
 	char* d;
 
-	if (Gfilename[0] == '/')
-		return Gfilename;
+	if (eb->Gfilename[0] == '/')
+		return eb->Gfilename;
 
 	/* If we've already calculated the absolute path, return it */
-	if (Gabspath)
-		return Gabspath;
+	if (eb->Gabspath)
+		return eb->Gabspath;
 
 	/* Get working directory and strip any trailing slashes */
 	wdbuflen = _POSIX_PATH_MAX + 1;
@@ -338,19 +359,19 @@ static char const * getfullRCSname(void)
 	wdbuf[dlen] = 0;
 
 	/* Ignore leading `./'s in Gfilename. */
-	for (r = Gfilename;  r[0]=='.' && r[1] == '/';  r += 2)
+	for (r = eb->Gfilename;  r[0]=='.' && r[1] == '/';  r += 2)
 		while (r[2] == '/')
 			r++;
 
 	/* Build full pathname.  */
-	Gabspath = d = xmalloc(dlen + strlen(r) + 2);
+	eb->Gabspath = d = xmalloc(dlen + strlen(r) + 2);
 	memcpy(d, wdbuf, dlen);
 	d += dlen;
 	*d++ = '/';
 	strcpy(d, r);
 	free(wdbuf);
 
-	return Gabspath;
+	return eb->Gabspath;
 }
 
 /* Check if string starts with a keyword followed by a KDELIM or VDELIM */
@@ -377,70 +398,70 @@ static enum markers trymatch(char const *string)
 }
 
 /* Before line N, insert line L.  N is 0-origin.  */
-static void insertline(unsigned long n, uchar * l)
+static void insertline(editbuffer_t *eb, unsigned long n, uchar * l)
 {
-	if (n > Glinemax - Ggapsize)
+	if (n > Glinemax(eb) - Ggapsize(eb))
 		fatal_error("edit script tried to insert beyond eof");
-	if (!Ggapsize) {
-		if (Glinemax) {
-			Ggap = Ggapsize = Glinemax; Glinemax <<= 1;
-			Gline = xrealloc(Gline, sizeof(uchar *) * Glinemax);
+	if (!Ggapsize(eb)) {
+		if (Glinemax(eb)) {
+			Ggap(eb) = Ggapsize(eb) = Glinemax(eb); Glinemax(eb) <<= 1;
+			Gline(eb) = xrealloc(Gline(eb), sizeof(uchar *) * Glinemax(eb));
 		} else {
-			Glinemax = Ggapsize = 1024;
-			Gline = xmalloc(sizeof(uchar *) *  Glinemax);
+			Glinemax(eb) = Ggapsize(eb) = 1024;
+			Gline(eb) = xmalloc(sizeof(uchar *) *  Glinemax(eb));
 		}
 	}
-	if (n < Ggap)
-		memmove(Gline+n+Ggapsize, Gline+n, (Ggap-n) * sizeof(uchar *));
-	else if (Ggap < n)
-		memmove(Gline+Ggap, Gline+Ggap+Ggapsize, (n-Ggap) * sizeof(uchar *));
-	Gline[n] = l;
-	Ggap = n + 1;
-	Ggapsize--;
+	if (n < Ggap(eb))
+		memmove(Gline(eb)+n+Ggapsize(eb), Gline(eb)+n, (Ggap(eb)-n) * sizeof(uchar *));
+	else if (Ggap(eb) < n)
+		memmove(Gline(eb)+Ggap(eb), Gline(eb)+Ggap(eb)+Ggapsize(eb), (n-Ggap(eb)) * sizeof(uchar *));
+	Gline(eb)[n] = l;
+	Ggap(eb) = n + 1;
+	Ggapsize(eb)--;
 }
 
 /* Delete lines N through N+NLINES-1.  N is 0-origin.  */
-static void deletelines(unsigned long n, unsigned long nlines)
+static void deletelines(editbuffer_t *eb, unsigned long n, unsigned long nlines)
 {
 	unsigned long l = n + nlines;
-	if (Glinemax-Ggapsize < l  ||  l < n)
+	if (Glinemax(eb)-Ggapsize(eb) < l  ||  l < n)
 		fatal_error("edit script tried to delete beyond eof");
-	if (l < Ggap)
-		memmove(Gline+l+Ggapsize, Gline+l, (Ggap-l) * sizeof(uchar *));
-	else if (Ggap < n)
-		memmove(Gline+Ggap, Gline+Ggap+Ggapsize, (n-Ggap) * sizeof(uchar *));
-	Ggap = n;
-	Ggapsize += nlines;
+	if (l < Ggap(eb))
+		memmove(Gline(eb)+l+Ggapsize(eb), Gline(eb)+l, (Ggap(eb)-l) * sizeof(uchar *));
+	else if (Ggap(eb) < n)
+		memmove(Gline(eb)+Ggap(eb), Gline(eb)+Ggap(eb)+Ggapsize(eb), (n-Ggap(eb)) * sizeof(uchar *));
+	Ggap(eb) = n;
+	Ggapsize(eb) += nlines;
 }
 
-static long parsenum(void)
+static long parsenum(editbuffer_t *eb)
 {
 	int c;
 	long ret = 0;
-	for(c=in_buffer_getc(); isdigit(c); c=in_buffer_getc())
+	for(c=in_buffer_getc(eb); isdigit(c); c=in_buffer_getc(eb))
 		ret = (ret * 10) + (c - '0');
-	in_buffer_ungetc();
+	in_buffer_ungetc(eb);
 	return ret;
 }
 
-static int parse_next_delta_command(struct diffcmd *dc)
+static int parse_next_delta_command(editbuffer_t *eb, struct diffcmd *dc)
 {
 	int cmd;
 	long line1, nlines;
 
-	cmd = in_buffer_getc();
+	cmd = in_buffer_getc(eb);
 	if (cmd==EOF)
 		return -1;
 
-	line1 = parsenum();
+	line1 = parsenum(eb);
 
-	while (in_buffer_getc() == ' ')
+	while (in_buffer_getc(eb) == ' ')
 		;
-	in_buffer_ungetc();
+	in_buffer_ungetc(eb);
 
-	nlines = parsenum();
+	nlines = parsenum(eb);
 
-	while (in_buffer_getc() != '\n')
+	while (in_buffer_getc(eb) != '\n')
 		;
 
 	if (!nlines || (cmd != 'a' && cmd != 'd') || line1+nlines < line1)
@@ -462,89 +483,90 @@ static int parse_next_delta_command(struct diffcmd *dc)
 	return cmd == 'a';
 }
 
-static void escape_string(register char const *s)
+static void escape_string(editbuffer_t *eb, register char const *s)
 {
 	register char c;
 	for (;;) {
 		switch ((c = *s++)) {
 		case 0:		return;
-		case '\t':	out_fputs("\\t"); break;
-		case '\n':	out_fputs("\\n"); break;
-		case ' ':	out_fputs("\\040"); break;
-		case KDELIM:	out_fputs("\\044"); break;
-		case '\\':	out_fputs("\\\\"); break;
-		default:	out_putc(c); break;
+		case '\t':	out_fputs(eb, "\\t"); break;
+		case '\n':	out_fputs(eb, "\\n"); break;
+		case ' ':	out_fputs(eb, "\\040"); break;
+		case KDELIM:	out_fputs(eb, "\\044"); break;
+		case '\\':	out_fputs(eb, "\\\\"); break;
+		default:	out_putc(eb, c); break;
 		}
 	}
 }
 
 /* output the appropriate keyword value(s) */
-static void keyreplace(enum markers marker)
+static void keyreplace(editbuffer_t *eb, enum markers marker)
 {
 	const char *target_lockedby = NULL;	// Not wired in yet
 
 	char *leader = NULL;
 	char date_string[25];
-	enum expand_mode exp = Gexpand;
+	struct tm tm;
+	enum expand_mode exp = eb->Gexpand;
 	char const *sp = Keyword[(int)marker];
 
 	strftime(date_string, 25,
-		"%Y/%m/%d %H:%M:%S", localtime(&Gversion->date));
+		"%Y/%m/%d %H:%M:%S", localtime_r(&eb->Gversion->date, &tm));
 
 	if (exp != EXPANDKV)
-		out_printf("%c%s", KDELIM, sp);
+		out_printf(eb, "%c%s", KDELIM, sp);
 
 	if (exp != EXPANDKK) {
 		if (exp != EXPANDKV)
-			out_printf("%c%c", VDELIM, ' ');
+			out_printf(eb, "%c%c", VDELIM, ' ');
 
 		switch (marker) {
 		case Author:
-			out_fputs(Gversion->author);
+			out_fputs(eb, eb->Gversion->author);
 			break;
 		case Date:
-			out_fputs(date_string);
+			out_fputs(eb, date_string);
 			break;
 		case Id:
 		case Header:
 			if (marker == Id )
-				escape_string(basefilename(Gfilename));
-			else	escape_string(getfullRCSname());
-			out_printf(" %s %s %s %s",
-				Gversion_number, date_string,
-				Gversion->author, Gversion->state);
+				escape_string(eb, basefilename(eb->Gfilename));
+			else	escape_string(eb, getfullRCSname(eb));
+			out_printf(eb, " %s %s %s %s",
+				eb->Gversion_number, date_string,
+				eb->Gversion->author, eb->Gversion->state);
 			if (target_lockedby && exp == EXPANDKKVL)
-				out_printf(" %s", target_lockedby);
+				out_printf(eb, " %s", target_lockedby);
 			break;
 		case Locker:
 			if (target_lockedby && exp == EXPANDKKVL)
-				out_fputs(target_lockedby);
+				out_fputs(eb, target_lockedby);
 			break;
 		case Log:
 		case RCSfile:
-			escape_string(basefilename(Gfilename));
+			escape_string(eb, basefilename(eb->Gfilename));
 			break;
 		case Revision:
-			out_fputs(Gversion_number);
+			out_fputs(eb, eb->Gversion_number);
 			break;
 		case Source:
-			escape_string(getfullRCSname());
+			escape_string(eb, getfullRCSname(eb));
 			break;
 		case State:
-			out_fputs(Gversion->state);
+			out_fputs(eb, eb->Gversion->state);
 			break;
 		default:
 			break;
 		}
 
 		if (exp != EXPANDKV)
-			out_putc(' ');
+			out_putc(eb, ' ');
 	}
 
 #if 0
 /* Closing delimiter is processed again in expandline */
 	if (exp != EXPANDKV)
-	    out_putc(KDELIM);
+	    out_putc(eb, KDELIM);
 #endif
 
 	if (marker == Log) {
@@ -557,21 +579,21 @@ static void keyreplace(enum markers marker)
 		 * does not apply here, since we consume the input.
 		 */
 		if (exp != EXPANDKV)
-			out_putc(KDELIM);
+			out_putc(eb, KDELIM);
 
-		sp = Glog;
-		ls = strlen(Glog);
+		sp = eb->Glog;
+		ls = strlen(eb->Glog);
 		if (sizeof(ciklog)-1<=ls && !memcmp(sp,ciklog,sizeof(ciklog)-1))
 			return;
 
 		/* Back up to the start of the current input line */
                 int num_kdelims = 0;
 		for (;;) {
-			c = in_buffer_ungetc();
+			c = in_buffer_ungetc(eb);
 			if (c == EOF)
 				break;
 			if (c == '\n') {
-				in_buffer_getc();
+				in_buffer_getc(eb);
 				break;
 			}
 			if (c == KDELIM) {
@@ -580,17 +602,17 @@ static void keyreplace(enum markers marker)
                                    on one line. Make sure we don't backtrack
                                    into some other keyword! */
                                 if (num_kdelims > 2) {
-                                        in_buffer_getc();
+                                        in_buffer_getc(eb);
                                         break;
                                 }
-				kdelim_ptr = in_buffer_loc();
+				kdelim_ptr = in_buffer_loc(eb);
                         }
 		}
 
 		/* Copy characters before `$Log' into LEADER.  */
-		xxp = leader = xmalloc(kdelim_ptr - in_buffer_loc());
+		xxp = leader = xmalloc(kdelim_ptr - in_buffer_loc(eb));
 		for (cs = 0; ;  cs++) {
-			c = in_buffer_getc();
+			c = in_buffer_getc(eb);
 			if (c == KDELIM)
 				break;
 			leader[cs] = c;
@@ -614,31 +636,31 @@ static void keyreplace(enum markers marker)
 
 		/* Skip `$Log ... $' string.  */
 		do {
-			c = in_buffer_getc();
+			c = in_buffer_getc(eb);
 		} while (c != KDELIM);
 
-		out_putc('\n');
-		out_awrite(xxp, cs);
-		out_printf("Revision %s  %s  %s",
-				Gversion_number,
+		out_putc(eb, '\n');
+		out_awrite(eb, xxp, cs);
+		out_printf(eb, "Revision %s  %s  %s",
+				eb->Gversion_number,
 				date_string,
-				Gversion->author);
+				eb->Gversion->author);
 
 		/* Do not include state: it may change and is not updated.  */
 		cw = cs;
 		for (;  cw && (xxp[cw-1]==' ' || xxp[cw-1]=='\t');  --cw)
 			;
 		for (;;) {
-			out_putc('\n');
-			out_awrite(xxp, cw);
+			out_putc(eb, '\n');
+			out_awrite(eb, xxp, cw);
 			if (!ls)
 				break;
 			--ls;
 			c = *sp++;
 			if (c != '\n') {
-				out_awrite(xxp+cw, cs-cw);
+				out_awrite(eb, xxp+cw, cs-cw);
 				do {
-					out_putc(c);
+					out_putc(eb, c);
 					if (!ls)
 						break;
 					--ls;
@@ -650,7 +672,7 @@ static void keyreplace(enum markers marker)
 	}
 }
 
-static int expandline(void)
+static int expandline(editbuffer_t *eb)
 {
 	register int c = 0;
 	char * tp;
@@ -659,62 +681,62 @@ static int expandline(void)
         enum markers matchresult;
 	int orig_size;
 
-	if (Gkvlen < KEYLENGTH+3) {
-		Gkvlen = KEYLENGTH + 3;
-		Gkeyval = xrealloc(Gkeyval, Gkvlen);
+	if (eb->Gkvlen < KEYLENGTH+3) {
+		eb->Gkvlen = KEYLENGTH + 3;
+		eb->Gkeyval = xrealloc(eb->Gkeyval, eb->Gkvlen);
 	}
 	e = 0;
 	r = -1;
 
         for (;;) {
-	    c = in_buffer_getc();
+	    c = in_buffer_getc(eb);
 	    for (;;) {
 		switch (c) {
 		    case EOF:
 			goto uncache_exit;
 		    default:
-			out_putc(c);
+			out_putc(eb, c);
 			r = 0;
 			break;
 		    case '\n':
-			out_putc(c);
+			out_putc(eb, c);
 			r = 2;
 			goto uncache_exit;
 		    case KDELIM:
 			r = 0;
                         /* check for keyword */
                         /* first, copy a long enough string into keystring */
-			tp = Gkeyval;
+			tp = eb->Gkeyval;
 			*tp++ = KDELIM;
 			for (;;) {
-			    c = in_buffer_getc();
-			    if (tp <= &Gkeyval[KEYLENGTH] && latin1_alpha(c))
+			    c = in_buffer_getc(eb);
+			    if (tp <= &eb->Gkeyval[KEYLENGTH] && latin1_alpha(c))
 					*tp++ = c;
 			    else	break;
                         }
 			*tp++ = c; *tp = '\0';
-			matchresult = trymatch(Gkeyval+1);
+			matchresult = trymatch(eb->Gkeyval+1);
 			if (matchresult==Nomatch) {
 				tp[-1] = 0;
-				out_fputs(Gkeyval);
+				out_fputs(eb, eb->Gkeyval);
 				continue;   /* last c handled properly */
 			}
 
 			/* Now we have a keyword terminated with a K/VDELIM */
 			if (c==VDELIM) {
 			      /* try to find closing KDELIM, and replace value */
-			      tlim = Gkeyval + Gkvlen;
+			      tlim = eb->Gkeyval + eb->Gkvlen;
 			      for (;;) {
-				     c = in_buffer_getc();
+				     c = in_buffer_getc(eb);
 				      if (c=='\n' || c==KDELIM)
 					break;
 				      *tp++ =c;
 				      if (tlim <= tp) {
-					    orig_size = Gkvlen;
-					    Gkvlen *= 2;
-					    Gkeyval = xrealloc(Gkeyval, Gkvlen);
-					    tlim = Gkeyval + Gkvlen;
-					    tp = Gkeyval + orig_size;
+					    orig_size = eb->Gkvlen;
+					    eb->Gkvlen *= 2;
+					    eb->Gkeyval = xrealloc(eb->Gkeyval, eb->Gkvlen);
+					    tlim = eb->Gkeyval + eb->Gkvlen;
+					    tp = eb->Gkeyval + orig_size;
 
 					}
 				      if (c==EOF)
@@ -723,7 +745,7 @@ static int expandline(void)
 			      if (c!=KDELIM) {
 				    /* couldn't find closing KDELIM -- give up */
 				    *tp = 0;
-				    out_fputs(Gkeyval);
+				    out_fputs(eb, eb->Gkeyval);
 				    continue;   /* last c handled properly */
 			      }
 			}
@@ -736,10 +758,10 @@ static int expandline(void)
 			 * it.
 			 */
 			if (c == KDELIM)
-				in_buffer_ungetc();
+				in_buffer_ungetc(eb);
 
 			/* now put out the new keyword value */
-			keyreplace(matchresult);
+			keyreplace(eb, matchresult);
 			e = 1;
 			break;
                 }
@@ -749,38 +771,38 @@ static int expandline(void)
 
     keystring_eof:
 	*tp = 0;
-	out_fputs(Gkeyval);
+	out_fputs(eb, eb->Gkeyval);
     uncache_exit:
 	return r + e;
 }
 
-static void process_delta(Node *node, enum stringwork func)
+static void process_delta(editbuffer_t *eb, Node *node, enum stringwork func)
 {
 	long editline = 0, linecnt = 0, adjust = 0;
 	int editor_command;
 	struct diffcmd dc;
 	uchar *ptr;
 
-	Glog = node->p->log;
-	in_buffer_init((uchar *)node->p->text, 1);
-	Gversion = node->v;
-	cvs_number_string(&Gversion->number, Gversion_number);
+	eb->Glog = node->p->log;
+	in_buffer_init(eb, eb->Gmap + node->p->text.offset);
+	eb->Gversion = node->v;
+	cvs_number_string(eb->Gversion->number, eb->Gversion_number);
 
 	switch (func) {
 	case ENTER:
-		while( (ptr=in_get_line()) )
-			insertline(editline++, ptr);
+		while( (ptr=in_get_line(eb)) )
+			insertline(eb, editline++, ptr);
 	case EDIT:
 		dc.dafter = dc.adprev = 0;
-		while ((editor_command = parse_next_delta_command(&dc)) >= 0) {
+		while ((editor_command = parse_next_delta_command(eb, &dc)) >= 0) {
 			if (editor_command) {
 				editline = dc.line1 + adjust;
 				linecnt = dc.nlines;
 				while(linecnt--)
-					insertline(editline++, in_get_line());
+					insertline(eb, editline++, in_get_line(eb));
 				adjust += dc.nlines;
 			} else {
-				deletelines(dc.line1 - 1 + adjust, dc.nlines);
+				deletelines(eb, dc.line1 - 1 + adjust, dc.nlines);
 				adjust -= dc.nlines;
 			}
 		}
@@ -788,98 +810,104 @@ static void process_delta(Node *node, enum stringwork func)
 	}
 }
 
-static void finishedit(void)
+static void finishedit(editbuffer_t *eb)
 {
-	uchar **p, **lim, **l = Gline;
-	for (p=l, lim=l+Ggap;  p<lim;  ) {
-		in_buffer_init(*p++, 0);
-		expandline();
+	uchar **p, **lim, **l = Gline(eb);
+	for (p=l, lim=l+Ggap(eb);  p<lim;  ) {
+		in_buffer_init(eb, *p++);
+		expandline(eb);
 	}
-	for (p+=Ggapsize, lim=l+Glinemax;  p<lim;  ) {
-		in_buffer_init(*p++, 0);
-		expandline();
+	for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  ) {
+		in_buffer_init(eb, *p++);
+		expandline(eb);
 	}
 }
 
-static void snapshotline(register uchar * l)
+static void snapshotline(editbuffer_t *eb, register uchar * l)
 {
-	register int c;
-	do {
-		if ((c = *l++) == SDELIM  &&  *l++ != SDELIM)
+	uchar *e;
+	for (;;) {
+		e = (uchar *)scan_line((const char *)l);
+		if (*e == '\n') {
+			out_awrite(eb, (char *)l, e + 1 - l);
 			return;
-		out_putc(c);
-	} while (c != '\n');
-
+		}
+		out_awrite(eb, (char *)l, e - l);
+		if (e[1] != SDELIM)
+			return;
+		out_putc(eb, SDELIM);
+		l = e + 2;
+	}
 }
 
-static void snapshotedit(void)
+static void snapshotedit(editbuffer_t *eb)
 {
-	uchar **p, **lim, **l=Gline;
-	for (p=l, lim=l+Ggap;  p<lim;  )
-		snapshotline(*p++);
-	for (p+=Ggapsize, lim=l+Glinemax;  p<lim;  )
-		snapshotline(*p++);
+	uchar **p, **lim, **l=Gline(eb);
+	for (p=l, lim=l+Ggap(eb);  p<lim;  )
+		snapshotline(eb, *p++);
+	for (p+=Ggapsize(eb), lim=l+Glinemax(eb);  p<lim;  )
+		snapshotline(eb, *p++);
 }
 
-static void enter_branch(Node *node)
+static void enter_branch(editbuffer_t *eb, Node *node)
 {
-	uchar **p = xmalloc(sizeof(uchar *) * stack[depth].linemax);
-	memcpy(p, stack[depth].line, sizeof(uchar *) * stack[depth].linemax);
-	stack[depth + 1] = stack[depth];
-	stack[depth + 1].next_branch = node->sib;
-	stack[depth + 1].line = p;
-	depth++;
+	uchar **p = xmalloc(sizeof(uchar *) * eb->stack[eb->depth].linemax);
+	memcpy(p, eb->stack[eb->depth].line, sizeof(uchar *) * eb->stack[eb->depth].linemax);
+	eb->stack[eb->depth + 1] = eb->stack[eb->depth];
+	eb->stack[eb->depth + 1].next_branch = node->sib;
+	eb->stack[eb->depth + 1].line = p;
+	eb->depth++;
 }
 
 void generate_files(cvs_file *cvs, void (*hook)(Node *node, void *buf, unsigned long len))
 {
-	if (head_node == NULL)
+	if (cvs->nodehash.head_node == NULL)
 		return;
 
-	int expandflag = Gexpand < EXPANDKO;
-	Node *node = head_node;
-	depth = 0;
-	Gfilename = cvs->name;
+	editbuffer_t eb_store, *eb = &eb_store;
+	Node *node = cvs->nodehash.head_node;
+	memset(eb, 0, sizeof(editbuffer_t));
+	eb->Ginbuf = &eb->in_buffer_store;
+	eb->Gfilename = cvs->name;
+	eb->Gmap = (uchar *)cvs->map;
 	if (!suppress_keyword_expansion && cvs->expand)
-	    Gexpand = expand_override(cvs->expand);
+	    eb->Gexpand = expand_override(cvs->expand);
 	else
-	    Gexpand = EXPANDKK;
-	Gabspath = NULL;
-	Gline = NULL; Ggap = Ggapsize = Glinemax = 0;
-	stack[0].node = node;
-	process_delta(node, ENTER);
+	    eb->Gexpand = EXPANDKK;
+	int expandflag = eb->Gexpand < EXPANDKO;
+	Gline(eb) = NULL; Ggap(eb) = Ggapsize(eb) = Glinemax(eb) = 0;
+	eb->stack[0].node = node;
+	process_delta(eb, node, ENTER);
 	while (1) {
 		if (node->file) {
-			out_buffer_init();
+			out_buffer_init(eb);
 			if (expandflag)
-				finishedit();
+				finishedit(eb);
 			else
-				snapshotedit();
-			hook(node, out_buffer_text(), out_buffer_count());
-			out_buffer_cleanup();
+				snapshotedit(eb);
+			hook(node, out_buffer_text(eb), out_buffer_count(eb));
+			out_buffer_cleanup(eb);
 		}
 		node = node->down;
 		if (node) {
-			enter_branch(node);
+			enter_branch(eb, node);
 			goto Next;
 		}
-		while ((node = stack[depth].node->to) == NULL) {
-			free(stack[depth].line);
-			if (!depth)
+		while ((node = eb->stack[eb->depth].node->to) == NULL) {
+			free(eb->stack[eb->depth].line);
+			if (!eb->depth)
 				goto Done;
-			node = stack[depth--].next_branch;
+			node = eb->stack[eb->depth--].next_branch;
 			if (node) {
-				enter_branch(node);
+				enter_branch(eb, node);
 				break;
 			}
 		}
 Next:
-		stack[depth].node = node;
-		process_delta(node, EDIT);
+		eb->stack[eb->depth].node = node;
+		process_delta(eb, node, EDIT);
 	}
 Done:
-	free(Gkeyval);
-	Gkeyval = NULL;
-	Gkvlen = 0;
-	free(Gabspath);
+	free(eb->Gkeyval);
+	free(eb->Gabspath);
 }
@@ -19,15 +19,24 @@
 
 #include "cvs.h"
 
-void yyerror (char *msg);
-
-time_t skew_vulnerable = 0;
+void yyerror (void *scanner, cvs_file *cvsfile, char *msg);
 %}
 
+/*
+ * The parser is pure and each master gets its own scanner, so
+ * several files can be parsed at once; everything learned about
+ * the file lands in cvsfile.
+ */
+%define api.pure
+%parse-param {void *scanner}
+%parse-param {cvs_file *cvsfile}
+%lex-param {void *scanner}
+
 %union {
     int		i;
     time_t	date;
     char	*s;
+    cvs_text	text;
     cvs_number	number;
     cvs_symbol	*symbol;
     cvs_version	*version;
@@ -38,16 +47,22 @@ time_t skew_vulnerable = 0;
     cvs_file	*file;
 }
 
+%{
+int yylex (YYSTYPE *lvalp, void *scanner);
+%}
+
 %token		HEAD BRANCH ACCESS SYMBOLS LOCKS COMMENT DATE
 %token		BRANCHES DELTATYPE NEXT COMMITID EXPAND
 %token		KOPT PERMISSIONS FILENAME MERGEPOINT
 %token		DESC LOG TEXT STRICT AUTHOR STATE
 %token		SEMI COLON INT
 %token		BRAINDAMAGED_NUMBER
-%token <s>	HEX NAME DATA TEXT_DATA
+%token <s>	HEX NAME DATA
+%token <text>	TEXT_DATA
 %token <number>	NUMBER
 
-%type <s>	text log
+%type <s>	log
+%type <text>	text
 %type <symbol>	symbollist symbol symbols
 %type <version>	revision
 %type <vlist>	revisions
@@ -75,16 +90,16 @@ headers		: header headers
 		|
 		;
 header		: HEAD opt_number SEMI
-		  { this_file->head = $2; }
+		  { cvsfile->head = atom_cvs_number (&$2); }
 		| BRANCH NUMBER SEMI
-		  { this_file->branch = $2; }
+		  { cvsfile->branch = atom_cvs_number (&$2); }
 		| ACCESS SEMI
 		| symbollist
-		  { this_file->symbols = $1; }
+		  { cvsfile->symbols = $1; }
 		| LOCKS locks SEMI lock_type
 		| COMMENT DATA SEMI
 		| EXPAND DATA SEMI
-		  { this_file->expand = $2; }
+		  { cvsfile->expand = $2; }
 		;
 locks		: locks lock
 		|
@@ -106,9 +121,9 @@ symbols		: symbols symbol
 		;
 symbol		: name COLON NUMBER
 		  {
-			$$ = calloc (1, sizeof (cvs_symbol));
+			$$ = arena_alloc (&cvsfile->arena, sizeof (cvs_symbol));
 			$$->name = $1;
-			$$->number = $3;
+			$$->number = atom_cvs_number (&$3);
 		  }
 		;
 fscked_symbol	: name COLON BRAINDAMAGED_NUMBER
@@ -127,7 +142,7 @@ name		: NAME
 revisions	: revisions revision
 		  { *$1 = $2; $$ = &$2->next; }
 		|
-		  { $$ = &this_file->versions; }
+		  { $$ = &cvsfile->versions; }
 		;
 
 revtrailer	: paramlist opt_commitid paramlist 
@@ -145,25 +160,26 @@ parameter : deltatype | kopt | permissions | mergepoint | filename;
 
 revision	: NUMBER date author state branches next revtrailer
 		  {
-			$$ = calloc (1, sizeof (cvs_version));
-			$$->number = $1;
+			$$ = arena_alloc (&cvsfile->arena, sizeof (cvs_version));
+			$$->number = atom_cvs_number (&$1);
 			$$->date = $2;
 			$$->author = $3;
 			$$->state = $4;
 			$$->dead = !strcmp ($4, "dead");
 			$$->branches = $5;
-			$$->parent = $6;
+			$$->parent = atom_cvs_number (&$6);
 			$$->commitid = $7;
-			if ($$->commitid == NULL && skew_vulnerable < $$->date)
-			    skew_vulnerable = $$->date;
-			hash_version($$);
-			++this_file->nversions;
+			if ($$->commitid == NULL &&
+			    cvsfile->skew_vulnerable < $$->date)
+			    cvsfile->skew_vulnerable = $$->date;
+			hash_version(&cvsfile->nodehash, $$);
+			++cvsfile->nversions;
 			
 		  }
 		;
 date		: DATE NUMBER SEMI
 		  {
-			$$ = lex_date (&$2);
+			$$ = lex_date (&$2, scanner);
 		  }
 		;
 author		: AUTHOR NAME SEMI
@@ -177,10 +193,10 @@ branches	: BRANCHES numbers SEMI
 		;
 numbers		: NUMBER numbers
 		  {
-			$$ = calloc (1, sizeof (cvs_branch));
+			$$ = arena_alloc (&cvsfile->arena, sizeof (cvs_branch));
 			$$->next = $2;
-			$$->number = $1;
-			hash_branch($$);
+			$$->number = atom_cvs_number (&$1);
+			hash_branch(&cvsfile->nodehash, $$);
 		  }
 		|
 		  { $$ = NULL; }
@@ -202,25 +218,25 @@ commitid	: COMMITID NAME SEMI
 		  { $$ = $2; }
 		;
 desc		: DESC DATA
-		  { this_file->description = $2; }
+		  { cvsfile->description = $2; }
 		;
 patches		: patches patch
 		  { *$1 = $2; $$ = &$2->next; }
 		|
-		  { $$ = &this_file->patches; }
+		  { $$ = &cvsfile->patches; }
 		;
 patch		: NUMBER log text
-		  { $$ = calloc (1, sizeof (cvs_patch));
-		    $$->number = $1;
+		  { $$ = arena_alloc (&cvsfile->arena, sizeof (cvs_patch));
+		    $$->number = atom_cvs_number (&$1);
 			if (!strcmp($2, "Initial revision\n")) {
-				if (strlen(this_file->description) == 0)
+				if (strlen(cvsfile->description) == 0)
 					$$->log = strdup("*** empty log message ***\n");
 				else
-					$$->log = this_file->description;
+					$$->log = cvsfile->description;
 			} else
 				$$->log = $2;
 		    $$->text = $3;
-		    hash_patch($$);
+		    hash_patch(&cvsfile->nodehash, $$);
 		  }
 		;
 log		: LOG DATA
@@ -246,8 +262,9 @@ mergepoint	: MERGEPOINT NUMBER SEMI
 		;
 %%
 
-void yyerror (char *msg)
+void yyerror (void *scanner, cvs_file *cvsfile, char *msg)
 {
-	fprintf (stderr, "parse error %s at %s\n", msg, lex_text ());
+	fprintf (stderr, "%s: parse error %s at %s\n",
+		 cvsfile->name, msg, lex_text (scanner));
 	exit(1);
 }
@@ -27,7 +27,7 @@ static void dump_symbols (char *name, cvs_symbol *symbols)
     printf ("%s\n", name);
     while (symbols) {
 	printf ("\t");
-	dump_number (symbols->name, &symbols->number);
+	dump_number (symbols->name, symbols->number);
 	printf ("\n");
 	symbols = symbols->next;
     }
@@ -38,7 +38,7 @@ static void dump_branches (char *name, cvs_branch *branches)
 {
     printf ("%s", name);
     while (branches) {
-	dump_number (" ", &branches->number);
+	dump_number (" ", branches->number);
 	branches = branches->next;
     }
     printf ("\n");
@@ -49,11 +49,11 @@ static void dump_versions (char *name, cvs_version *versions)
 {
     printf ("%s\n", name);
     while (versions) {
-	dump_number  ("\tnumber:", &versions->number); printf ("\n");
+	dump_number  ("\tnumber:", versions->number); printf ("\n");
 	printf       ("\t\tdate:     %s", ctime (&versions->date));
 	printf       ("\t\tauthor:   %s\n", versions->author);
 	dump_branches("\t\tbranches:", versions->branches);
-	dump_number  ("\t\tparent:  ", &versions->parent); printf ("\n");
+	dump_number  ("\t\tparent:  ", versions->parent); printf ("\n");
 	if (versions->commitid)
 	    printf   ("\t\tcommitid: %s\n", versions->commitid);
 	printf ("\n");
@@ -66,9 +66,9 @@ static void dump_patches (char *name, cvs_patch *patches)
 {
     printf ("%s\n", name);
     while (patches) {
-	dump_number ("\tnumber: ", &patches->number); printf ("\n");
+	dump_number ("\tnumber: ", patches->number); printf ("\n");
 	printf ("\t\tlog: %d bytes\n", (int)strlen (patches->log));
-	printf ("\t\ttext: %d bytes\n", (int)strlen (patches->text));
+	printf ("\t\ttext: %d bytes\n", (int)patches->text.length);
 	patches = patches->next;
     }
 }
@@ -76,8 +76,8 @@ static void dump_patches (char *name, cvs_patch *patches)
 static void dump_file (cvs_file *file)
 /* dump the patch list of a given file to standard output */
 {
-    dump_number ("head", &file->head);  printf ("\n");
-    dump_number ("branch", &file->branch); printf ("\n");
+    dump_number ("head", file->head);  printf ("\n");
+    dump_number ("branch", file->branch); printf ("\n");
     dump_symbols ("symbols", file->symbols);
     dump_versions ("versions", file->versions);
     dump_patches ("patches", file->patches);
@@ -124,6 +124,7 @@ dot_ref_name (FILE *f, rev_ref *ref)
 static void dot_commit_graph (rev_commit *c, rev_ref *branch)
 {
     rev_file	*f;
+    char	when[CTIME_LEN];
 
     printf ("\"");
     if (branch)
@@ -131,7 +132,7 @@ static void dot_commit_graph (rev_commit *c, rev_ref *branch)
 //    if (c->tail)
 //	printf ("*** TAIL");
     printf ("\\n");
-    printf ("%s\\n", ctime_nonl (&c->date));
+    printf ("%s\\n", ctime_nonl (&c->date, when));
     dump_log (stdout, c->log);
     printf ("\\n");
     if (difffiles) {
@@ -141,35 +142,37 @@ static void dot_commit_graph (rev_commit *c, rev_ref *branch)
 	for (fl = diff->add; fl; fl = fl->next) {
 	    if (!rev_file_list_has_filename (diff->del, fl->file->name)) {
 		printf ("+");
-		dump_number (fl->file->name, &fl->file->number);
+		dump_number (fl->file->name, fl->file->number);
 		printf ("\\n");
 	    }
 	}
 	for (fl = diff->add; fl; fl = fl->next) {
 	    if (rev_file_list_has_filename (diff->del, fl->file->name)) {
 		printf ("|");
-		dump_number (fl->file->name, &fl->file->number);
+		dump_number (fl->file->name, fl->file->number);
 		printf ("\\n");
 	    }
 	}
 	for (fl = diff->del; fl; fl = fl->next) {
 	    if (!rev_file_list_has_filename (diff->add, fl->file->name)) {
 		printf ("-");
-		dump_number (fl->file->name, &fl->file->number);
+		dump_number (fl->file->name, fl->file->number);
 		printf ("\\n");
 	    }
 	}
 	rev_diff_free (diff);
     } else {
-	int		i, j;
-	for (i = 0; i < c->ndirs; i++) {
-	    rev_dir *dir = c->dirs[i];
+	int		i, j, ndirs;
+	rev_dir		**dirs = rev_tree_dirs (c->tree, &ndirs);
+	for (i = 0; i < ndirs; i++) {
+	    rev_dir *dir = dirs[i];
 	    for (j = 0; j < dir->nfiles; j++) {
-		 f = dir->files[j];
-		 dump_number (f->name, &f->number);
+		 f = rev_dir_file (dir, j);
+		 dump_number (f->name, f->number);
 		 printf ("\\n");
 	    }
 	}
+	free (dirs);
     }
     printf ("%p", c);
     printf ("\"");
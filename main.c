@@ -20,7 +20,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <getopt.h>
+#include <pthread.h>
 
 #ifndef MAXPATHLEN
 #define MAXPATHLEN  10240
@@ -41,19 +45,19 @@ static rev_execution_mode rev_mode = ExecuteExport;
 char *branch_prefix = "refs/heads/";
 
 char *
-stringify_revision (char *name, char *sep, cvs_number *number)
-/* stringify a revision number */
+stringify_revision (char *name, char *sep, cvs_number *number,
+		    char *result, size_t size)
+/* stringify a revision number into a caller-supplied buffer */
 {
-    static char result[BUFSIZ];
-
+    result[0] = '\0';
     if (name != NULL)
     {
-	if (strlen(name) >= sizeof(result) - strlen(sep) - 1)
+	if (strlen(name) >= size - strlen(sep) - 1)
 	{
 	    fprintf(stderr, "Filename too long\n");
 	    exit(1);
 	}
-	strncpy(result, name, sizeof(result) - strlen(sep) - 1);
+	strncpy(result, name, size - strlen(sep) - 1);
 	strcat(result, sep);
     }
 
@@ -64,7 +68,7 @@ stringify_revision (char *name, char *sep, cvs_number *number)
 
 	for (i = 0; i < number->c; i++) {
 	    snprintf (digits, sizeof(digits)-1, "%d", number->n[i]);
-	    if (strlen(result) + 1 + strlen(digits) >= sizeof(result))
+	    if (strlen(result) + 1 + strlen(digits) >= size)
 	    {
 		fprintf(stderr, "Revision number too long\n");
 		exit(1);
@@ -82,7 +86,9 @@ void
 dump_number_file (FILE *f, char *name, cvs_number *number)
 /* dump a filename/CVS-version pair to a specified file pointer */
 {
-    fputs(stringify_revision(name, " ", number), f);
+    char buf[BUFSIZ];
+
+    fputs(stringify_revision(name, " ", number, buf, sizeof(buf)), f);
 }
 
 void
@@ -96,17 +102,20 @@ void
 dump_rev_commit (rev_commit *c)
 {
     rev_file	*f;
-    int		i, j;
+    rev_dir	**dirs;
+    int		i, j, ndirs;
 
-    for (i = 0; i < c->ndirs; i++) {
-	rev_dir	*dir = c->dirs[i];
+    dirs = rev_tree_dirs (c->tree, &ndirs);
+    for (i = 0; i < ndirs; i++) {
+	rev_dir	*dir = dirs[i];
 	
 	for (j = 0; j < dir->nfiles; j++) {
-	    f = dir->files[j];
-	    dump_number (f->name, &f->number);
+	    f = rev_dir_file (dir, j);
+	    dump_number (f->name, f->number);
 	    printf (" ");
 	}
     }
+    free (dirs);
     printf ("\n");
 }
 
@@ -141,48 +150,211 @@ typedef struct _rev_split {
 } rev_split;
 
 char *
-ctime_nonl (time_t *date)
+ctime_nonl (time_t *date, char *buf)
+/* ctime() without the newline, into a caller-supplied CTIME_LEN buffer */
 {
-    char	*d = ctime (date);
+    char	*d = ctime_r (date, buf);
     
     d[strlen(d)-1] = '\0';
     return d;
 }
 
-extern FILE *yyin;
 static int err = 0;
-char *yyfilename;
-extern int yylineno;
+static int threads = 1;
+
+/* guards err, the phase timers and load progress while files load */
+static pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Time spent in each phase, reported with -v.  Loading is timed once
+ * on the wall clock; parse, branch and generate are its stages, each
+ * summed over the loader threads, so with -j they add up to more
+ * than the load took.
+ */
+enum phase { PHASE_PARSE, PHASE_BRANCH, PHASE_GENERATE,
+	     PHASE_LOAD, PHASE_MERGE, PHASE_EXPORT, NPHASES };
+static char *phase_names[NPHASES] = {
+    "parse", "branch", "generate", "load", "merge", "export"
+};
+static double phase_times[NPHASES];
+
+static double
+timestamp (void)
+{
+    struct timeval  tv;
+
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double
+phase_end (enum phase phase, double start)
+/* charge the time since start to a phase, returning the current time */
+{
+    double  now = timestamp ();
+
+    pthread_mutex_lock (&load_mutex);
+    phase_times[phase] += now - start;
+    pthread_mutex_unlock (&load_mutex);
+    return now;
+}
+
+static char *
+cvs_image_grow (char *old, size_t used, size_t alloc)
+/* a buffer for alloc bytes of master, padded for scan_line() */
+{
+    void    *image;
+
+    if (posix_memalign (&image, SCAN_PAD, alloc + SCAN_PAD) != 0) {
+	fprintf (stderr, "cvs-fast-export: out of memory reading a master\n");
+	exit (1);
+    }
+    if (old) {
+	memcpy (image, old, used);
+	free (old);
+    }
+    return image;
+}
+
+static bool
+cvs_file_map (cvs_file *cvs)
+/* make an in-core image of a master, mapping it when we can */
+{
+    struct stat	buf;
+    size_t	alloc;
+    ssize_t	n;
+    int		fd;
+
+    fd = open (cvs->name, O_RDONLY);
+    if (fd < 0)
+	return false;
+    if (fstat (fd, &buf) != 0) {
+	close (fd);
+	return false;
+    }
+    cvs->mode = buf.st_mode;
+    /*
+     * The delta engine peeks at the byte after a closing '@' to tell
+     * it from an "@@" escape.  A mapping only has that byte when the
+     * master doesn't fill its last page, so one that does is read.
+     */
+    if (S_ISREG (buf.st_mode) && buf.st_size > 0 &&
+	buf.st_size % sysconf (_SC_PAGESIZE) != 0) {
+	cvs->map = mmap (NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cvs->map != MAP_FAILED) {
+	    cvs->mapsize = buf.st_size;
+	    cvs->mapped = true;
+	    (void) madvise (cvs->map, cvs->mapsize, MADV_SEQUENTIAL);
+	    close (fd);
+	    mem_charge (MEM_IMAGE, 1, cvs->mapsize);
+	    return true;
+	}
+	cvs->map = NULL;
+    }
+    /* pipes and the like can't be mapped; fall back to buffered reads */
+    alloc = S_ISREG (buf.st_mode) && buf.st_size > 0 ? buf.st_size + 1 : BUFSIZ;
+    cvs->map = cvs_image_grow (NULL, 0, alloc);
+    while ((n = read (fd, cvs->map + cvs->mapsize,
+		      alloc - cvs->mapsize)) > 0) {
+	cvs->mapsize += n;
+	if (cvs->mapsize == alloc)
+	    cvs->map = cvs_image_grow (cvs->map, cvs->mapsize, alloc *= 2);
+    }
+    close (fd);
+    memset (cvs->map + cvs->mapsize, '\0', alloc - cvs->mapsize + SCAN_PAD);
+    mem_charge (MEM_IMAGE, 1, cvs->mapsize);
+    return n == 0;
+}
+
+static void
+cvs_file_unmap (cvs_file *cvs)
+/* release the in-core image of a master */
+{
+    if (cvs->map)
+	mem_charge (MEM_IMAGE, -1, -(long) cvs->mapsize);
+    if (cvs->mapped)
+	munmap (cvs->map, cvs->mapsize);
+    else
+	free (cvs->map);
+    cvs->map = NULL;
+    cvs->mapsize = 0;
+    cvs->mapped = false;
+}
+
+static unsigned long load_pages, load_pages_cached;
+static unsigned long node_lookups, node_probes;
+static int node_max_probe;
+static unsigned long arena_nalloc, arena_nblocks;
+
+static void
+load_count_cached (cvs_file *cvs)
+/* note how much of a freshly mapped master was already in core */
+{
+    size_t	    page = sysconf (_SC_PAGESIZE);
+    size_t	    npages = (cvs->mapsize + page - 1) / page;
+    size_t	    i, cached = 0;
+    unsigned char   *vec = xmalloc (npages);
 
-cvs_file	*this_file;
+    if (mincore (cvs->map, cvs->mapsize, vec) == 0) {
+	for (i = 0; i < npages; i++)
+	    cached += vec[i] & 1;
+	pthread_mutex_lock (&load_mutex);
+	load_pages += npages;
+	load_pages_cached += cached;
+	pthread_mutex_unlock (&load_mutex);
+    }
+    free (vec);
+}
 
 static rev_list *
-rev_list_file (char *name, int *nversions)
+rev_list_file (char *name, int *nversions, time_t *skew)
+/* parse a master and build its revision list; touches no global parse state */
 {
     rev_list	*rl;
-    struct stat	buf;
+    cvs_file	*cvs;
+    void	*scanner;
+    double	start;
 
-    yyin = fopen (name, "r");
-    if (!yyin) {
+    cvs = calloc (1, sizeof (cvs_file));
+    cvs->name = name;
+    cvs->arena.kind = MEM_PARSE;
+    cvs->nodehash.nodes.kind = MEM_NODE;
+    /* only an export replays the deltas */
+    cvs->headers_only = rev_mode != ExecuteExport;
+    if (!cvs_file_map (cvs)) {
 	perror (name);
+	pthread_mutex_lock (&load_mutex);
 	++err;
+	pthread_mutex_unlock (&load_mutex);
+    } else if (verbose && cvs->mapped)
+	load_count_cached (cvs);
+    start = timestamp ();
+    scanner = lex_init (cvs);
+    yyparse (scanner, cvs);
+    lex_free (scanner);
+    if (cvs->headers_only)
+	cvs_file_unmap (cvs);
+    start = phase_end (PHASE_PARSE, start);
+    rl = rev_list_cvs (cvs);
+    start = phase_end (PHASE_BRANCH, start);
+    if (rev_mode == ExecuteExport) {
+	generate_files(cvs, export_blob);
+	phase_end (PHASE_GENERATE, start);
     }
-    yyfilename = name;
-    yylineno = 0;
-    this_file = calloc (1, sizeof (cvs_file));
-    this_file->name = name;
-    if (yyin)
-	assert (fstat (fileno (yyin), &buf) == 0);
-    this_file->mode = buf.st_mode;
-    yyparse ();
-    fclose (yyin);
-    yyfilename = 0;
-    rl = rev_list_cvs (this_file);
-    if (rev_mode == ExecuteExport)
-	generate_files(this_file, export_blob);
-   
-    *nversions = this_file->nversions;
-    cvs_file_free (this_file);
+    /* delta texts are read in place, so keep the image until now */
+    cvs_file_unmap (cvs);
+
+    pthread_mutex_lock (&load_mutex);
+    node_lookups += cvs->nodehash.lookups;
+    node_probes += cvs->nodehash.probes;
+    if (node_max_probe < cvs->nodehash.max_probe)
+	node_max_probe = cvs->nodehash.max_probe;
+    arena_nalloc += cvs->arena.nalloc + cvs->nodehash.nodes.nalloc;
+    arena_nblocks += cvs->arena.nblocks + cvs->nodehash.nodes.nblocks;
+    pthread_mutex_unlock (&load_mutex);
+    *nversions = cvs->nversions;
+    *skew = cvs->skew_vulnerable;
+    cvs_file_free (cvs);
     return rl;
 }
 
@@ -196,6 +368,7 @@ dump_splits (rev_list *rl)
     int		ai, bi;
     rev_file	*af, *bf;
     char	*which;
+    char	when[CTIME_LEN];
 
     /* Find tails and mark splits */
     for (head = rl->heads; head; head = head->next) {
@@ -249,18 +422,18 @@ dump_splits (rev_list *rl)
 		bf = b->files[bi];
 		if (af != bf) {
 		    if (rev_file_later (af, bf)) {
-			fprintf (stderr, "a : %s ", ctime_nonl (&af->date));
-			dump_number_file (stderr, af->name, &af->number);
+			fprintf (stderr, "a : %s ", ctime_nonl (&af->date, when));
+			dump_number_file (stderr, af->name, af->number);
 			ai++;
 		    } else {
-			fprintf (stderr, " b: %s ", ctime_nonl (&bf->date));
-			dump_number_file (stderr, bf->name, &bf->number);
+			fprintf (stderr, " b: %s ", ctime_nonl (&bf->date, when));
+			dump_number_file (stderr, bf->name, bf->number);
 			bi++;
 		    }
 		    fprintf (stderr, "\n");
 		} else {
-//		    fprintf (stderr, "ab: %s ", ctime_nonl (&af->date));
-//		    dump_number_file (stderr, af->name, &af->number);
+//		    fprintf (stderr, "ab: %s ", ctime_nonl (&af->date, when));
+//		    dump_number_file (stderr, af->name, af->number);
 //		    fprintf (stderr, "\n");
 		    ai++;
 		    bi++;
@@ -275,7 +448,7 @@ dump_splits (rev_list *rl)
 	    while (ai < a->nfiles) {
 		af = a->files[ai];
 		fprintf (stderr, "%s: ", which);
-		dump_number_file (stderr, af->name, &af->number);
+		dump_number_file (stderr, af->name, af->number);
 		fprintf (stderr, "\n");
 		ai++;
 	    }
@@ -324,11 +497,11 @@ dump_rev_tree (rev_list *rl)
 		    if (ef != pf) {
 			if (rev_file_later (ef, pf)) {
 			    fprintf (stdout, "+ ");
-			    dump_number_file (stdout, ef->name, &ef->number);
+			    dump_number_file (stdout, ef->name, ef->number);
 			    ei++;
 			} else {
 			    fprintf (stdout, "- ");
-			    dump_number_file (stdout, pf->name, &pf->number);
+			    dump_number_file (stdout, pf->name, pf->number);
 			    pi++;
 			}
 			fprintf (stdout, "\n");
@@ -340,21 +513,21 @@ dump_rev_tree (rev_list *rl)
 		while (ei < c->nfiles) {
 		    ef = c->files[ei];
 		    fprintf (stdout, "+ ");
-		    dump_number_file (stdout, ef->name, &ef->number);
+		    dump_number_file (stdout, ef->name, ef->number);
 		    ei++;
 		    fprintf (stdout, "\n");
 		}
 		while (pi < p->nfiles) {
 		    pf = p->files[pi];
 		    fprintf (stdout, "- ");
-		    dump_number_file (stdout, pf->name, &pf->number);
+		    dump_number_file (stdout, pf->name, pf->number);
 		    pi++;
 		    fprintf (stdout, "\n");
 		}
 	    } else {
 		for (i = 0; i < c->nfiles; i++) {
 		    printf ("\t\t\t");
-		    dump_number (c->files[i]->name, &c->files[i]->number);
+		    dump_number (c->files[i]->name, c->files[i]->number);
 		    printf ("\n");
 		}
 	    }
@@ -408,10 +581,222 @@ strcommonendingwith(char *a, char *b, char endc)
 typedef struct _rev_filename {
     struct _rev_filename	*next;
     char		*file;
+    off_t		size;		/* from listing, -1 if not stat()ed */
+    rev_list		*rl;		/* filled in by the loader */
+    time_t		skew;
+    bool		started;	/* claimed by a loader */
+    bool		prefetched;	/* readahead asked for */
 } rev_filename;
 
 int load_current_file, load_total_files;
 
+/*
+ * Files are loaded by a pool of -j threads.  The files are sorted
+ * biggest first and dealt round-robin onto per-thread queues, so one
+ * huge master doesn't start last and hold up the rest.  A thread
+ * works from the front of its own queue and, once that is empty,
+ * steals from the back of the others.  Results stay with their
+ * names, so the merge sees them in input order however the work
+ * was spread.
+ */
+typedef struct _load_queue {
+    pthread_mutex_t	lock;
+    rev_filename	**tasks;
+    int			head, tail;	/* unclaimed: tasks[head..tail-1] */
+} load_queue;
+
+static load_queue *load_queues;
+static int load_strip;
+
+/*
+ * While masters are being parsed, ask the kernel to start reading
+ * the next few in the order they were dealt, so a cold or remote
+ * repository isn't waited on one file at a time.  At most
+ * READAHEAD_FILES masters, and readahead_budget bytes, are asked
+ * for ahead of the loaders.  The window is kept under load_mutex.
+ * A master from --root with a lone loader hasn't been stat()ed, so
+ * its size is only learnt when it is opened to be prefetched; the
+ * window lets such a file in while there is room left, and may run
+ * over the budget by that one file.
+ */
+#define READAHEAD_FILES	32
+
+static off_t readahead_budget = 32 << 20;
+static rev_filename **load_order;
+static int load_nfile, load_started, load_ahead;
+static off_t load_ahead_bytes;
+
+static void
+load_prefetch (rev_filename *fn)
+/* start reading a master into the page cache */
+{
+    int		fd = open (fn->file, O_RDONLY);
+    struct stat	st;
+
+    if (fd < 0)
+	return;
+    (void) posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (fn->size < 0 && fstat (fd, &st) == 0) {
+	pthread_mutex_lock (&load_mutex);
+	/* once started, the file is no longer counted in the window */
+	if (!fn->started) {
+	    fn->size = st.st_size;
+	    load_ahead_bytes += fn->size;
+	}
+	pthread_mutex_unlock (&load_mutex);
+    }
+    close (fd);
+}
+
+static int
+load_start (rev_filename *fn, rev_filename **ahead)
+/*
+ * Note that a master is being loaded and move the readahead window
+ * on, returning the files to prefetch.  Call with load_mutex held.
+ */
+{
+    rev_filename    *next;
+    int		    n = 0;
+
+    fn->started = true;
+    if (fn->prefetched && fn->size >= 0)
+	load_ahead_bytes -= fn->size;
+    load_started++;
+    /*
+     * Files stolen from the backs of queues start out of order, so
+     * the window can hold more than READAHEAD_FILES unstarted files;
+     * ahead only has room for that many.
+     */
+    while (n < READAHEAD_FILES && load_ahead < load_nfile &&
+	   load_ahead < load_started + READAHEAD_FILES) {
+	next = load_order[load_ahead];
+	if (next->started) {
+	    load_ahead++;
+	    continue;
+	}
+	/* a file that doesn't fit in the budget waits for room */
+	if (readahead_budget <= 0 ||
+	    (next->size < 0 ? load_ahead_bytes >= readahead_budget :
+	     load_ahead_bytes + next->size > readahead_budget))
+	    break;
+	load_ahead++;
+	next->prefetched = true;
+	if (next->size >= 0)
+	    load_ahead_bytes += next->size;
+	ahead[n++] = next;
+    }
+    return n;
+}
+
+static rev_filename *
+load_claim (int self)
+/* take the next file from our own queue, or steal one */
+{
+    rev_filename    *fn = NULL;
+    load_queue	    *q;
+    int		    i;
+
+    for (i = 0; i < threads && !fn; i++) {
+	q = &load_queues[(self + i) % threads];
+	pthread_mutex_lock (&q->lock);
+	if (q->head < q->tail)
+	    fn = i == 0 ? q->tasks[q->head++] : q->tasks[--q->tail];
+	pthread_mutex_unlock (&q->lock);
+    }
+    return fn;
+}
+
+static void *
+load_worker (void *arg)
+/* load files until every queue runs dry */
+{
+    rev_filename    *fn, *ahead[READAHEAD_FILES];
+    int		    nversions, i, n;
+
+    while ((fn = load_claim ((int) (intptr_t) arg))) {
+	pthread_mutex_lock (&load_mutex);
+	++load_current_file;
+	if (verbose)
+	    fprintf(stderr, "Processing %s\n", fn->file);
+	load_status (fn->file + load_strip);
+	n = load_start (fn, ahead);
+	pthread_mutex_unlock (&load_mutex);
+	for (i = 0; i < n; i++)
+	    load_prefetch (ahead[i]);
+	fn->rl = rev_list_file (fn->file, &nversions, &fn->skew);
+    }
+    return NULL;
+}
+
+static int
+load_size_compare (const void *av, const void *bv)
+/* biggest files first */
+{
+    const rev_filename	*a = *(rev_filename * const *) av;
+    const rev_filename	*b = *(rev_filename * const *) bv;
+
+    if (a->size > b->size)
+	return -1;
+    if (a->size < b->size)
+	return 1;
+    return 0;
+}
+
+static void
+load_files (rev_filename *fn_head, int nfile, int strip)
+/* fill in the rev_list of every file on the list */
+{
+    rev_filename    **tasks, *fn;
+    pthread_t	    *workers;
+    int		    i;
+
+    tasks = xmalloc (nfile * sizeof (rev_filename *));
+    for (i = 0, fn = fn_head; fn; fn = fn->next)
+	tasks[i++] = fn;
+    load_strip = strip;
+    load_queues = xmalloc (threads * sizeof (load_queue));
+    for (i = 0; i < threads; i++) {
+	pthread_mutex_init (&load_queues[i].lock, NULL);
+	load_queues[i].tasks = xmalloc ((nfile / threads + 1) *
+					sizeof (rev_filename *));
+	load_queues[i].head = load_queues[i].tail = 0;
+    }
+    /* a lone thread just goes through the files in order */
+    if (threads > 1)
+	qsort (tasks, nfile, sizeof (rev_filename *), load_size_compare);
+    for (i = 0; i < nfile; i++) {
+	load_queue  *q = &load_queues[i % threads];
+	q->tasks[q->tail++] = tasks[i];
+    }
+    load_order = tasks;
+    load_nfile = nfile;
+    load_started = load_ahead = 0;
+    load_ahead_bytes = 0;
+
+    if (threads <= 1)
+	load_worker ((void *) 0);
+    else {
+	workers = xmalloc (threads * sizeof (pthread_t));
+	for (i = 0; i < threads; i++)
+	    if (pthread_create (&workers[i], NULL, load_worker,
+				(void *) (intptr_t) i) != 0) {
+		perror ("pthread_create");
+		exit (1);
+	    }
+	for (i = 0; i < threads; i++)
+	    pthread_join (workers[i], NULL);
+	free (workers);
+    }
+
+    for (i = 0; i < threads; i++) {
+	pthread_mutex_destroy (&load_queues[i].lock);
+	free (load_queues[i].tasks);
+    }
+    free (load_queues);
+    free (load_order);
+    load_order = NULL;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -424,6 +809,11 @@ main (int argc, char **argv)
     int		    c;
     char	    *file;
     int		    nfile = 0;
+    char	    *root = NULL;
+    walk_file	    *walked = NULL;
+    int		    nwalked = 0, w = 0;
+    double	    start;
+    time_t	    skew_vulnerable = 0;
 
     while (1) {
 	static struct option options[] = {
@@ -437,8 +827,12 @@ main (int argc, char **argv)
             { "graph",              0, 0, 'g' },
             { "remote",             1, 0, 'e' },
             { "strip",              1, 0, 's' },
+            { "threads",            1, 0, 'j' },
+            { "root",               1, 0, 'D' },
+            { "readahead",          1, 0, 'a' },
+            { "mem-stats",          0, 0, 'M' },
 	};
-	int c = getopt_long(argc, argv, "+hVw:grvA:R:Tke:s:", options, NULL);
+	int c = getopt_long(argc, argv, "+hVw:grvA:R:Tke:s:j:", options, NULL);
 	if (c < 0)
 	    break;
 	switch (c) {
@@ -457,6 +851,10 @@ main (int argc, char **argv)
 		   " -T                              Force deteministic dates\n"
                    " -e --remote                     Relocate branches to refs/remotes/REMOTE\n"
                    " -s --strip                      Strip the given prefix instead of longest common prefix\n"
+                   " -j --threads=N                  Load and merge with N threads\n"
+                   "    --root=DIR                   Find the ,v files under DIR instead of reading names\n"
+                   "    --readahead=MB               Read ahead at most MB of upcoming files (0 disables)\n"
+                   "    --mem-stats                  Report memory use per structure after each phase\n"
 		   "\n"
 		   "Example: find -name '*,v' | cvs-fast-export\n");
 	    return 0;
@@ -498,6 +896,32 @@ main (int argc, char **argv)
 	case 's':
 		strip = strlen(optarg) + 1;
 		break;
+	case 'j':
+	    threads = atoi (optarg);
+	    if (threads < 1) {
+		fprintf(stderr, "cvs-fast-export: -j needs a positive thread count\n");
+		return 1;
+	    }
+	    break;
+	case 'D':
+	    root = optarg;
+	    break;
+	case 'a':
+	    {
+		char	*end;
+		long	mb = strtol (optarg, &end, 10);
+
+		if (end == optarg || *end || mb < 0 ||
+		    mb > (long) (LONG_MAX >> 20)) {
+		    fprintf(stderr, "cvs-fast-export: --readahead needs a size in MB, 0 or more\n");
+		    return 1;
+		}
+		readahead_budget = (off_t) mb << 20;
+	    }
+	    break;
+	case 'M':
+	    mem_stats = true;
+	    break;
 	default: /* error message already emitted */
 	    fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
 	    return 1;
@@ -508,14 +932,22 @@ main (int argc, char **argv)
     argv += optind-1;
     argc -= optind-1;
 
-    /* force times using mktime to be interpreted in UTC */
+    /* dates are formatted with localtime() and ctime(); make that UTC */
     setenv ("TZ", "UTC", 1);
     time_now = time (NULL);
+    /* sizes are only wanted for scheduling threads */
+    if (root)
+	walked = walk_tree (root, threads, threads > 1, &nwalked);
     for (;;)
     {
 	struct stat stb;
 
-	if (argc < 2) {
+	if (root) {
+	    if (w == nwalked)
+		break;
+	    file = walked[w].name;
+	    stb.st_size = walked[w++].size;
+	} else if (argc < 2) {
 	    int l;
 	    /* coverity[tainted_data] Safe, never handed to exec */
 	    if (fgets (name, sizeof (name) - 1, stdin) == NULL)
@@ -530,13 +962,16 @@ main (int argc, char **argv)
 		break;
 	}
 
-	if (stat(file, &stb) != 0)
+	if (root)
+	    ;	/* the walker only hands back masters */
+	else if (stat(file, &stb) != 0)
 	    continue;
 	else if (S_ISDIR(stb.st_mode) != 0)
 	    continue;
 
 	fn = calloc (1, sizeof (rev_filename));
 	fn->file = atom (file);
+	fn->size = stb.st_size;
 	*fn_tail = fn;
 	fn_tail = &fn->next;
 	if (strip > 0 && last != NULL) {
@@ -554,20 +989,21 @@ main (int argc, char **argv)
 	last = fn->file;
 	nfile++;
     }
+    free (walked);
     if (rev_mode == ExecuteExport)
 	export_init();
     load_total_files = nfile;
     load_current_file = 0;
+    start = timestamp ();
+    load_files (fn_head, nfile, strip);
+    phase_end (PHASE_LOAD, start);
     while (fn_head) {
-	int nversions;
-	
 	fn = fn_head;
 	fn_head = fn_head->next;
-	++load_current_file;
-	if (verbose)
-	    fprintf(stderr, "Processing %s\n", fn->file);
-	load_status (fn->file + strip);
-	rl = rev_list_file (fn->file, &nversions);
+	rl = fn->rl;
+	tag_flush (rl, fn->file);
+	if (skew_vulnerable < fn->skew)
+	    skew_vulnerable = fn->skew;
 	if (rl->watch)
 	    dump_rev_tree (rl);
 	*tail = rl;
@@ -579,7 +1015,13 @@ main (int argc, char **argv)
 	fprintf(stderr, "Commits before this date lack commitids: %s",
 		ctime(&skew_vulnerable));
     load_status_next ();
-    rl = rev_list_merge (head);
+    if (mem_stats)
+	mem_report (stderr, "load");
+    start = timestamp ();
+    rl = rev_list_merge (head, threads);
+    start = phase_end (PHASE_MERGE, start);
+    if (mem_stats)
+	mem_report (stderr, "merge");
     if (rl) {
 	switch (rev_mode) {
 	case ExecuteGraph:
@@ -592,6 +1034,34 @@ main (int argc, char **argv)
 	    export_commits (rl, strip);
 	    break;
 	}
+	phase_end (PHASE_EXPORT, start);
+	if (mem_stats)
+	    mem_report (stderr, rev_mode == ExecuteExport ? "export" : "output");
+    }
+    if (verbose) {
+	int i;
+
+	fprintf (stderr, "%s: %.3fs (thread time ",
+		 phase_names[PHASE_LOAD], phase_times[PHASE_LOAD]);
+	for (i = PHASE_PARSE; i <= PHASE_GENERATE; i++)
+	    fprintf (stderr, "%s%s: %.3fs", i != PHASE_PARSE ? ", " : "",
+		     phase_names[i], phase_times[i]);
+	fprintf (stderr, ")");
+	for (i = PHASE_MERGE; i < NPHASES; i++)
+	    fprintf (stderr, ", %s: %.3fs", phase_names[i], phase_times[i]);
+	fprintf (stderr, "\n");
+	if (load_pages)
+	    fprintf (stderr, "%lu of %lu master pages (%.1f%%) were cached "
+		     "when parsed\n", load_pages_cached, load_pages,
+		     100.0 * load_pages_cached / load_pages);
+	if (node_lookups)
+	    fprintf (stderr, "%lu revision lookups, %.2f probes on average, "
+		     "%d at most\n", node_lookups,
+		     (double) node_probes / node_lookups, node_max_probe);
+	if (arena_nalloc)
+	    fprintf (stderr, "%lu parse structures allocated in %lu blocks\n",
+		     arena_nalloc, arena_nblocks);
+	atom_report (stderr);
     }
     if (rl)
 	rev_list_free (rl, 0);
@@ -608,5 +1078,7 @@ main (int argc, char **argv)
     free_author_map ();
     if (revision_map)
 	fclose(revision_map);
+    if (mem_stats)
+	mem_report (stderr, "cleanup");
     return err;
 }
@@ -0,0 +1,92 @@
+/*
+ * Memory accounting for --mem-stats.
+ *
+ * The major structures charge what they allocate and release to a
+ * counter per kind, and main() prints live and peak figures at the
+ * end of each phase.  The loader threads charge concurrently, so the
+ * counters are updated atomically; nothing is counted unless the
+ * report was asked for.
+ *
+ * Arenas charge the blocks they malloc() rather than the objects
+ * carved out of them, so the bytes are what the structure really
+ * costs.  The blob spool is on disk, not in core, but it is counted
+ * the same way.
+ */
+
+#include "cvs.h"
+#include <sys/resource.h>
+
+bool mem_stats = false;
+
+typedef struct _mem_count {
+    long	objects, bytes;
+    long	peak_objects, peak_bytes;
+} mem_count;
+
+/* the last slot is the total over all kinds */
+static mem_count mem_counts[NMEM + 1];
+
+static char *mem_names[NMEM] = {
+    "parse structures", "nodes", "master images", "atoms",
+    "revision numbers", "commits", "file revisions", "directories",
+    "tags", "blob spool", "mark map",
+};
+
+static void
+mem_peak (long *peak, long value)
+/* raise *peak to value if it is lower */
+{
+    long	p = __atomic_load_n (peak, __ATOMIC_RELAXED);
+
+    while (value > p &&
+	   !__atomic_compare_exchange_n (peak, &p, value, true,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+static void
+mem_add (mem_count *m, long objects, long bytes)
+{
+    if (objects)
+	mem_peak (&m->peak_objects,
+		  __atomic_add_fetch (&m->objects, objects, __ATOMIC_RELAXED));
+    if (bytes)
+	mem_peak (&m->peak_bytes,
+		  __atomic_add_fetch (&m->bytes, bytes, __ATOMIC_RELAXED));
+}
+
+void
+mem_charge (enum mem_kind kind, long objects, long bytes)
+/* count objects and bytes coming into (or, if negative, leaving) use */
+{
+    if (!mem_stats)
+	return;
+    mem_add (&mem_counts[kind], objects, bytes);
+    mem_add (&mem_counts[NMEM], objects, bytes);
+}
+
+void
+mem_report (FILE *f, char *when)
+/* print the counters as they stand at the end of a phase */
+{
+    struct rusage   ru;
+    mem_count	    *m;
+    int		    i;
+
+    fprintf (f, "memory after %s:%*s%12s %14s %12s %14s\n", when,
+	     (int) (12 - strlen (when)), "",
+	     "objects", "bytes", "peak objects", "peak bytes");
+    for (i = 0; i <= NMEM; i++) {
+	m = &mem_counts[i];
+	if (i < NMEM && !m->peak_objects && !m->peak_bytes)
+	    continue;
+	fprintf (f, "  %-22s %12ld %14ld %12ld %14ld\n",
+		 i < NMEM ? mem_names[i] : "total",
+		 m->objects, m->bytes, m->peak_objects, m->peak_bytes);
+    }
+    if (getrusage (RUSAGE_SELF, &ru) == 0)
+	fprintf (f, "  %-22s %41ld\n", "peak resident set",
+		 ru.ru_maxrss * 1024L);
+}
+
+/* end */
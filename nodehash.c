@@ -1,121 +1,146 @@
 #include "cvs.h"
 
-static Node *table[4096];
-static int entries;
+static unsigned node_hash(cvs_number *n)
+/* mix the address of an interned number */
+{
+	uint64_t x = (uintptr_t)n;
+
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return (unsigned)x;
+}
 
-Node *head_node;
+static Node **node_slot(nodehash *context, cvs_number *n)
+/* find the slot holding n, or the empty one where it would go */
+{
+	unsigned mask = context->size - 1;
+	unsigned i = node_hash(n) & mask;
+	int probe = 1;
+	Node **slot;
+
+	for (;;) {
+		slot = &context->table[i];
+		if (!*slot || (*slot)->number == n)
+			break;
+		i = (i + 1) & mask;
+		probe++;
+	}
+	context->lookups++;
+	context->probes += probe;
+	if (probe > context->max_probe)
+		context->max_probe = probe;
+	return slot;
+}
 
-static Node *hash_number(cvs_number *n)
+static void node_grow(nodehash *context)
+/* double the table, rehashing what's there */
+{
+	Node **old = context->table;
+	int oldsize = context->size, i;
+	unsigned mask;
+
+	context->size = oldsize ? oldsize * 2 : 64;
+	context->table = calloc(context->size, sizeof(Node *));
+	mem_charge(MEM_NODE, 0, (context->size - oldsize) * sizeof(Node *));
+	mask = context->size - 1;
+	for (i = 0; i < oldsize; i++) {
+		unsigned j;
+		if (!old[i])
+			continue;
+		for (j = node_hash(old[i]->number) & mask; context->table[j];
+		     j = (j + 1) & mask)
+			;
+		context->table[j] = old[i];
+	}
+	free(old);
+}
+
+static Node *hash_number(nodehash *context, cvs_number *n)
 /* look up the node associated with a specifued CVS release number */
 {
-	cvs_number key = *n;
-	Node *p;
-	int hash;
-	int i;
+	cvs_number key;
+	Node **slot;
 
-	if (key.c > 2 && !key.n[key.c - 2]) {
+	/* a magic branch number stands for the branch itself */
+	if (n->c > 2 && !n->n[n->c - 2]) {
+		key = *n;
 		key.n[key.c - 2] = key.n[key.c - 1];
 		key.c--;
+		n = atom_cvs_number(&key);
 	}
-	if (key.c & 1)
-		key.n[key.c] = 0;
-	for (i = 0, hash = 0; i < key.c - 1; i++)
-		hash += key.n[i];
-	hash = (hash * 256 + key.n[key.c - 1]) % 4096;
-	for (p = table[hash]; p; p = p->hash_next) {
-		if (p->number.c != key.c)
-			continue;
-		for (i = 0; i < key.c && p->number.n[i] == key.n[i]; i++)
-			;
-		if (i == key.c)
-			return p;
+	if (2 * (context->entries + 1) > context->size)
+		node_grow(context);
+	slot = node_slot(context, n);
+	if (!*slot) {
+		*slot = arena_alloc(&context->nodes, sizeof(Node));
+		(*slot)->number = n;
+		context->entries++;
 	}
-	p = calloc(1, sizeof(Node));
-	p->number = key;
-	p->hash_next = table[hash];
-	table[hash] = p;
-	entries++;
-	return p;
+	return *slot;
 }
 
-static Node *find_parent(cvs_number *n, int depth)
+static Node *find_parent(nodehash *context, cvs_number *n, int depth)
 /* find the parent node of the specified prefix of a release number */
 {
-	cvs_number key = *n;
-	Node *p;
-	int hash;
-	int i;
-
-	key.c -= depth;
-	for (i = 0, hash = 0; i < key.c - 1; i++)
-		hash += key.n[i];
-	hash = (hash * 256 + key.n[key.c - 1]) % 4096;
-	for (p = table[hash]; p; p = p->hash_next) {
-		if (p->number.c != key.c)
-			continue;
-		for (i = 0; i < key.c && p->number.n[i] == key.n[i]; i++)
-			;
-		if (i == key.c)
-			break;
-	}
-	return p;
+	n = cvs_number_prefix(n, depth);
+	if (!n || !context->size)
+		return NULL;
+	return *node_slot(context, n);
 }
 
-void hash_version(cvs_version *v)
+void hash_version(nodehash *context, cvs_version *v)
 /* intern a version onto the node list */
 {
 	char name[CVS_MAX_REV_LEN];
-	v->node = hash_number(&v->number);
+	v->node = hash_number(context, v->number);
 	if (v->node->v) {
 		fprintf(stderr, "more than one delta with number %s\n",
-			cvs_number_string(&v->node->number, name));
+			cvs_number_string(v->node->number, name));
 	} else {
 		v->node->v = v;
 	}
-	if (v->node->number.c & 1) {
+	if (v->node->number->c & 1) {
 		fprintf(stderr, "revision with odd depth (%s)\n",
-			cvs_number_string(&v->node->number, name));
+			cvs_number_string(v->node->number, name));
 	}
 }
 
-void hash_patch(cvs_patch *p)
+void hash_patch(nodehash *context, cvs_patch *p)
 /* intern a patch onto the node list */
 {
 	char name[CVS_MAX_REV_LEN];
-	p->node = hash_number(&p->number);
+	p->node = hash_number(context, p->number);
 	if (p->node->p) {
 		fprintf(stderr, "more than one delta with number %s\n",
-			cvs_number_string(&p->node->number, name));
+			cvs_number_string(p->node->number, name));
 	} else {
 		p->node->p = p;
 	}
-	if (p->node->number.c & 1) {
+	if (p->node->number->c & 1) {
 		fprintf(stderr, "patch with odd depth (%s)\n",
-			cvs_number_string(&p->node->number, name));
+			cvs_number_string(p->node->number, name));
 	}
 }
 
-void hash_branch(cvs_branch *b)
+void hash_branch(nodehash *context, cvs_branch *b)
 /* intern a branch onto the node list */
 {
-	b->node = hash_number(&b->number);
+	b->node = hash_number(context, b->number);
 }
 
-void clean_hash(void)
+void clean_hash(nodehash *context)
 /* discard the node list */
 {
-	int i;
-	for (i = 0; i < 4096; i++) {
-		Node *p = table[i];
-		table[i] = NULL;
-		while (p) {
-			Node *q = p->hash_next;
-			free(p);
-			p = q;
-		}
-	}
-	entries = 0;
-	head_node = NULL;
+	arena_free(&context->nodes);
+	mem_charge(MEM_NODE, 0, -(long)(context->size * sizeof(Node *)));
+	free(context->table);
+	context->table = NULL;
+	context->size = 0;
+	context->entries = 0;
+	context->head_node = NULL;
 }
 
 static int compare(const void *a, const void *b)
@@ -123,80 +148,75 @@ static int compare(const void *a, const void *b)
 {
 	Node *x = *(Node * const *)a, *y = *(Node * const *)b;
 	int n, i;
-	n = x->number.c;
-	if (n < y->number.c)
+	n = x->number->c;
+	if (n < y->number->c)
 		return -1;
-	if (n > y->number.c)
+	if (n > y->number->c)
 		return 1;
 	for (i = 0; i < n; i++) {
-		if (x->number.n[i] < y->number.n[i])
+		if (x->number->n[i] < y->number->n[i])
 			return -1;
-		if (x->number.n[i] > y->number.n[i])
+		if (x->number->n[i] > y->number->n[i])
 			return 1;
 	}
 	return 0;
 }
 
-static void try_pair(Node *a, Node *b)
+static void try_pair(nodehash *context, Node *a, Node *b)
 {
-	int n = a->number.c;
+	int n = a->number->c;
 
-	if (n == b->number.c) {
-		int i;
+	if (n == b->number->c) {
 		if (n == 2) {
 			a->next = b;
 			b->to = a;
 			return;
 		}
-		for (i = n - 2; i >= 0; i--)
-			if (a->number.n[i] != b->number.n[i])
-				break;
-		if (i < 0) {
+		if (cvs_number_prefix(a->number, 1) ==
+		    cvs_number_prefix(b->number, 1)) {
 			a->next = b;
 			a->to = b;
 			return;
 		}
 	} else if (n == 2) {
-		head_node = a;
+		context->head_node = a;
 	}
-	if ((b->number.c & 1) == 0) {
+	if ((b->number->c & 1) == 0) {
 		b->starts = 1;
 		/* can the code below ever be needed? */
-		Node *p = find_parent(&b->number, 1);
+		Node *p = find_parent(context, b->number, 1);
 		if (p)
 			p->next = b;
 	}
 }
 
-void build_branches(void)
-/* set head_node global and build branch links in the node list */ 
+void build_branches(nodehash *context)
+/* set head_node and build branch links in the node list */ 
 {
-	if (entries == 0)
+	if (context->entries == 0)
 		return;
 
-	Node **v = malloc(sizeof(Node *) * entries), **p = v;
+	Node **v = malloc(sizeof(Node *) * context->entries), **p = v;
 	int i;
 
-	for (i = 0; i < 4096; i++) {
-		Node *q;
-		for (q = table[i]; q; q = q->hash_next)
-			*p++ = q;
-	}
-	qsort(v, entries, sizeof(Node *), compare);
+	for (i = 0; i < context->size; i++)
+		if (context->table[i])
+			*p++ = context->table[i];
+	qsort(v, context->entries, sizeof(Node *), compare);
 	/* only trunk? */
-	if (v[entries-1]->number.c == 2)
-		head_node = v[entries-1];
-	for (p = v + entries - 2 ; p >= v; p--)
-		try_pair(p[0], p[1]);
-	for (p = v + entries - 1 ; p >= v; p--) {
+	if (v[context->entries-1]->number->c == 2)
+		context->head_node = v[context->entries-1];
+	for (p = v + context->entries - 2 ; p >= v; p--)
+		try_pair(context, p[0], p[1]);
+	for (p = v + context->entries - 1 ; p >= v; p--) {
 		Node *a = *p, *b = NULL;
 		if (!a->starts)
 			continue;
-		b = find_parent(&a->number, 2);
+		b = find_parent(context, a->number, 2);
 		if (!b) {
 			char name[CVS_MAX_REV_LEN];
 			fprintf(stderr, "no parent for %s\n",
-				cvs_number_string(&a->number, name));
+				cvs_number_string(a->number, name));
 			continue;
 		}
 		a->sib = b->down;
@@ -26,6 +26,7 @@
 
 static rev_commit *
 rev_find_cvs_commit (rev_list *rl, cvs_number *number)
+/* number must be interned */
 {
     rev_ref	*h;
     rev_commit	*c;
@@ -37,7 +38,7 @@ rev_find_cvs_commit (rev_list *rl, cvs_number *number)
 	for (c = h->commit; c; c = c->parent)
 	{
 	     f = c->file;
-	     if (cvs_number_compare (&f->number, number) == 0)
+	     if (f->number == number)
 		    return c;
 	     if (c->tail)
 		 break;
@@ -50,22 +51,35 @@ rev_find_cvs_commit (rev_list *rl, cvs_number *number)
  * Construct a branch using CVS revision numbers
  */
 static rev_commit *
-rev_branch_cvs (cvs_file *cvs, cvs_number *branch)
+rev_branch_cvs (rev_list *rl, cvs_file *cvs, cvs_number *branch)
 {
     cvs_number	n;
     rev_commit	*head = NULL;
     rev_commit	*c, *p, *gc;
-    Node	*node;
+    rev_commit	*block;
+    rev_file	*files;
+    Node	*first, *node;
+    int		ncommit = 0;
 
     n = *branch;
     n.n[n.c-1] = -1;
-    for (node = cvs_find_version (cvs, &n); node; node = node->next) {
+    first = cvs_find_version (cvs, &n);
+    for (node = first; node; node = node->next)
+	if (node->v)
+	    ncommit++;
+    if (!ncommit)
+	return NULL;
+    /* fill the block from the end, so the head comes first */
+    block = arena_alloc_array (&rl->commits, ncommit, sizeof (rev_commit));
+    files = arena_alloc_array (&rl->filerevs, ncommit, sizeof (rev_file));
+    for (node = first; node; node = node->next) {
 	cvs_version *v = node->v;
 	cvs_patch *p = node->p;
 	rev_commit *c;
 	if (!v)
 	     continue;
-	c = calloc (1, sizeof (rev_commit));
+	c = &block[--ncommit];
+	c->file = &files[ncommit];
 	c->date = v->date;
 	c->commitid = v->commitid;
 	c->author = v->author;
@@ -76,7 +90,9 @@ rev_branch_cvs (cvs_file *cvs, cvs_number *branch)
 	else
 	    c->nfiles = 1;
 	/* leave this around so the branch merging stuff can find numbers */
-	c->file = rev_file_rev (cvs->name, &v->number, v->date);
+	c->file->name = cvs->name;
+	c->file->number = v->number;
+	c->file->date = v->date;
 	if (!v->dead) {
 	    node->file = c->file;
 	    c->file->mode = cvs->mode;
@@ -97,8 +113,8 @@ rev_branch_cvs (cvs_file *cvs, cvs_number *branch)
 	if (time_compare (p->file->date, c->file->date) > 0)
 	{
 	    fprintf (stderr, "Warning: %s:", cvs->name);
-	    dump_number_file (stderr, " ", &p->file->number);
-	    dump_number_file (stderr, " is newer than", &c->file->number);
+	    dump_number_file (stderr, " ", p->file->number);
+	    dump_number_file (stderr, " is newer than", c->file->number);
 
 	    /* Try to catch an odd one out, such as a commit with the
 	     * clock set wrong.  Dont push back all commits for that,
@@ -106,11 +122,11 @@ rev_branch_cvs (cvs_file *cvs, cvs_number *branch)
 	     * parent. */
 	    if (gc && time_compare (p->file->date, gc->file->date) <= 0)
 	    {
-	      dump_number_file (stderr, ", adjusting", &c->file->number);
+	      dump_number_file (stderr, ", adjusting", c->file->number);
 	      c->file->date = p->file->date;
 	      c->date = p->date;
 	    } else {
-	      dump_number_file (stderr, ", adjusting", &c->file->number);
+	      dump_number_file (stderr, ", adjusting", c->file->number);
 	      p->file->date = c->file->date;
 	      p->date = c->date;
 	    }
@@ -146,7 +162,7 @@ rev_list_patch_vendor_branch (rev_list *rl, cvs_file *cvs)
     trunk = rl->heads;
     for (h_p = &rl->heads; (h = *h_p);) {
 	delete_head = 0;
-	if (h->commit && cvs_is_vendor (&h->commit->file->number))
+	if (h->commit && cvs_is_vendor (h->commit->file->number))
 	{
 	    /*
 	     * Find version 1.2 on the trunk.
@@ -226,14 +242,14 @@ rev_list_patch_vendor_branch (rev_list *rl, cvs_file *cvs)
 		    char	name[MAXPATHLEN];
 		    cvs_number	branch;
 
-		    branch = vlast->file->number;
+		    branch = *vlast->file->number;
 		    branch.c--;
 		    cvs_number_string (&branch, rev);
 		    snprintf (name, sizeof (name),
 			      "import-%s", rev);
 		    vendor->name = atom (name);
 		    vendor->parent = trunk;
-		    vendor->degree = vlast->file->number.c;
+		    vendor->degree = vlast->file->number->c;
 		}
 		for (vr = vendor->commit; vr; vr = vr->parent)
 		{
@@ -279,7 +295,7 @@ rev_list_patch_vendor_branch (rev_list *rl, cvs_file *cvs)
 #if DEBUG
     fprintf (stderr, "%s spliced:\n", cvs->name);
     for (t = trunk->commit; t; t = t->parent) {
-	dump_number_file (stderr, "\t", &t->file->number);
+	dump_number_file (stderr, "\t", t->file->number);
 	fprintf (stderr, "\n");
     }
 #endif
@@ -328,10 +344,9 @@ rev_list_graft_branches (rev_list *rl, cvs_file *cvs)
 	     */
 	    for (cv = cvs->versions; cv; cv = cv->next) {
 		for (cb = cv->branches; cb; cb = cb->next) {
-		    if (cvs_number_compare (&cb->number,
-					    &c->file->number) == 0)
+		    if (cb->number == c->file->number)
 		    {
-			c->parent = rev_find_cvs_commit (rl, &cv->number);
+			c->parent = rev_find_cvs_commit (rl, cv->number);
 			c->tail = 1;
 			break;
 		    }
@@ -343,7 +358,7 @@ rev_list_graft_branches (rev_list *rl, cvs_file *cvs)
 		     * check for a parallel vendor branch
 		     */
 		    for (cb = cv->branches; cb; cb = cb->next) {
-			if (cvs_is_vendor (&cb->number)) {
+			if (cvs_is_vendor (cb->number)) {
 			    cvs_number	v_n;
 			    rev_commit	*v_c, *n_v_c;
 			    fprintf (stderr, "Found merge into vendor branch\n");
@@ -367,9 +382,9 @@ rev_list_graft_branches (rev_list *rl, cvs_file *cvs)
 			    {
 				fprintf (stderr, "%s: rewrite branch", cvs->name);
 				dump_number_file (stderr, " branch point",
-						  &v_c->file->number);
+						  v_c->file->number);
 				dump_number_file (stderr, " branch version",
-						  &c->file->number);
+						  c->file->number);
 				fprintf (stderr, "\n");
 				c->parent = v_c;
 			    }
@@ -400,7 +415,7 @@ rev_list_find_branch (rev_list *rl, cvs_number *number)
     while (n.c >= 2)
     {
 	for (h = rl->heads; h; h = h->next) {
-	    if (cvs_same_branch (&h->number, &n)) {
+	    if (cvs_same_branch (h->number, &n)) {
 		break;
 	    }
 	}
@@ -423,38 +438,38 @@ rev_list_set_refs (rev_list *rl, cvs_file *cvs)
      */
     for (s = cvs->symbols; s; s = s->next) {
 	c = NULL;
-	if (cvs_is_head (&s->number)) {
+	if (cvs_is_head (s->number)) {
 	    for (h = rl->heads; h; h = h->next) {
-		if (cvs_same_branch (&h->commit->file->number, &s->number))
+		if (cvs_same_branch (h->commit->file->number, s->number))
 		    break;
 	    }
 	    if (h) {
 		if (!h->name) {
 		    h->name = s->name;
-		    h->degree = cvs_number_degree (&s->number);
+		    h->degree = cvs_number_degree (s->number);
 		} else
 		    h = rev_list_add_head (rl, h->commit, s->name,
-					   cvs_number_degree (&s->number));
+					   cvs_number_degree (s->number));
 	    } else {
-		cvs_number	n;
+		cvs_number	*n;
 
 		n = s->number;
-		while (n.c >= 4) {
-		    n.c -= 2;
-		    c = rev_find_cvs_commit (rl, &n);
+		while (n->c >= 4) {
+		    n = cvs_number_prefix (n, 2);
+		    c = rev_find_cvs_commit (rl, n);
 		    if (c)
 			break;
 		}
 		if (c)
 		    h = rev_list_add_head (rl, c, s->name,
-					   cvs_number_degree (&s->number));
+					   cvs_number_degree (s->number));
 	    }
 	    if (h)
 		h->number = s->number;
 	} else {
-	    c = rev_find_cvs_commit (rl, &s->number);
+	    c = rev_find_cvs_commit (rl, s->number);
 	    if (c)
-		tag_commit(c, s->name);
+		tag_queue(rl, c, s->name);
 	}
     }
     /*
@@ -472,11 +487,11 @@ rev_list_set_refs (rev_list *rl, cvs_file *cvs)
 	}
 	if (!c)
 	    continue;
-	n = c->file->number;
+	n = *c->file->number;
 	/* convert to branch form */
 	n.n[n.c-1] = n.n[n.c-2];
 	n.n[n.c-2] = 0;
-	h->number = n;
+	h->number = atom_cvs_number (&n);
 	h->degree = cvs_number_degree (&n);
 	/* compute name after patching parents */
     }
@@ -486,11 +501,11 @@ rev_list_set_refs (rev_list *rl, cvs_file *cvs)
     for (h = rl->heads; h; h = h->next) {
 	cvs_number	n;
 
-	if (h->number.c >= 4) {
-	    n = h->number;
+	if (h->number->c >= 4) {
+	    n = *h->number;
 	    n.c -= 2;
 	    h->parent = rev_list_find_branch (rl, &n);
-	    if (!h->parent && ! cvs_is_vendor (&h->number))
+	    if (!h->parent && ! cvs_is_vendor (h->number))
 		fprintf (stderr, "Warning: %s: branch %s has no parent\n",
 			 cvs->name, h->name);
 	}
@@ -498,7 +513,7 @@ rev_list_set_refs (rev_list *rl, cvs_file *cvs)
 	    char	name[1024];
 	    char	rev[CVS_MAX_REV_LEN];
 
-	    cvs_number_string (&h->number, rev);
+	    cvs_number_string (h->number, rev);
 	    fprintf (stderr, "Warning: %s: unnamed branch %s from %s\n",
 		     cvs->name, rev, h->parent->name);
 	    sprintf (name, "%s-UNNAMED-BRANCH", h->parent->name);
@@ -509,28 +524,53 @@ rev_list_set_refs (rev_list *rl, cvs_file *cvs)
 
 /*
  * Dead file revisions get an extra rev_file object which may be
- * needed during branch merging. Clean those up before returning
- * the resulting rev_list
+ * needed during branch merging. Drop those before returning the
+ * resulting rev_list, and gather up the live ones in revision
+ * order so rev_list_index_files can number them
  */
 
+static int
+rev_file_number_compare (const void *a, const void *b)
+{
+    return cvs_number_compare ((*(rev_file * const *) a)->number,
+			       (*(rev_file * const *) b)->number);
+}
+
 static void
-rev_list_free_dead_files (rev_list *rl)
+rev_list_gather_files (rev_list *rl)
 {
     rev_ref	*h;
     rev_commit	*c;
+    int		n = 0;
 
     for (h = rl->heads; h; h = h->next) {
 	if (h->tail)
 	    continue;
 	for (c = h->commit; c; c = c->parent) {
-	    if (c->nfiles == 0) {
-		rev_file_free (c->file);
+	    if (c->nfiles == 0)
 		c->file = 0;
-	    }
+	    else
+		n++;
+	    if (c->tail)
+		break;
+	}
+    }
+    if (!n)
+	return;
+    rl->files = xmalloc (n * sizeof (rev_file *));
+    mem_charge (MEM_FILE, 0, n * sizeof (rev_file *));
+    for (h = rl->heads; h; h = h->next) {
+	if (h->tail)
+	    continue;
+	for (c = h->commit; c; c = c->parent) {
+	    if (c->file)
+		rl->files[rl->nfiles++] = c->file;
 	    if (c->tail)
 		break;
 	}
     }
+    qsort (rl->files, rl->nfiles, sizeof (rev_file *),
+	   rev_file_number_compare);
 }
 
 #ifdef __UNUSED__
@@ -563,7 +603,7 @@ cvs_symbol_compare (cvs_symbol *a, cvs_symbol *b)
     }
     if (!b)
 	return 1;
-    return cvs_number_compare (&a->number, &b->number);
+    return cvs_number_compare (a->number, b->number);
 }
 
 static void
@@ -591,7 +631,7 @@ rev_list_sort_heads (rev_list *rl, cvs_file *cvs)
     for (h = rl->heads; h;) {
 	fprintf (stderr, "\t");
 	rev_list_dump_ref_parents (stderr, h->parent);
-	dump_number_file (stderr, h->name, &h->number);
+	dump_number_file (stderr, h->name, h->number);
 	fprintf (stderr, "\n");
 	h = h->next;
     }
@@ -610,14 +650,16 @@ rev_list_cvs (cvs_file *cvs)
     rev_ref	*t;
     cvs_version	*ctrunk = NULL;
 
-    build_branches();
+    rl->commits.kind = MEM_COMMIT;
+    rl->filerevs.kind = MEM_FILE;
+    build_branches(&cvs->nodehash);
     /*
      * Locate first revision on trunk branch
      */
     for (cv = cvs->versions; cv; cv = cv->next) {
-	if (cvs_is_trunk (&cv->number) &&
-	    (!ctrunk || cvs_number_compare (&cv->number,
-					    &ctrunk->number) < 0))
+	if (cvs_is_trunk (cv->number) &&
+	    (!ctrunk || cvs_number_compare (cv->number,
+					    ctrunk->number) < 0))
 	{
 	    ctrunk = cv;
 	}
@@ -626,13 +668,13 @@ rev_list_cvs (cvs_file *cvs)
      * Generate trunk branch
      */
     if (ctrunk)
-	trunk_number = ctrunk->number;
+	trunk_number = *ctrunk->number;
     else
 	trunk_number = lex_number ("1.1");
-    trunk = rev_branch_cvs (cvs, &trunk_number);
+    trunk = rev_branch_cvs (rl, cvs, &trunk_number);
     if (trunk) {
 	t = rev_list_add_head (rl, trunk, atom ("master"), 2);
-	t->number = trunk_number;
+	t->number = atom_cvs_number (&trunk_number);
     }
     else
 	fprintf(stderr, "warning - no master branch generated\n");
@@ -646,7 +688,7 @@ rev_list_cvs (cvs_file *cvs)
     for (cv = cvs->versions; cv; cv = cv->next) {
 	for (cb = cv->branches; cb; cb = cb->next)
 	{
-	    branch = rev_branch_cvs (cvs, &cb->number);
+	    branch = rev_branch_cvs (rl, cvs, cb->number);
 	    rev_list_add_head (rl, branch, NULL, 0);
 	}
     }
@@ -655,7 +697,7 @@ rev_list_cvs (cvs_file *cvs)
     rev_list_set_refs (rl, cvs);
     rev_list_sort_heads (rl, cvs);
     rev_list_set_tail (rl);
-    rev_list_free_dead_files (rl);
+    rev_list_gather_files (rl);
     rev_list_validate (rl);
     return rl;
 }
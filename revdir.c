@@ -2,7 +2,7 @@
  *  Copyright © 2006 Keith Packard <keithp@keithp.com>
  *
  *  This program is free software; you can redistribute it and/or modify
- *  it under the terms of the GNU General Public License version 2 as 
+ *  it under the terms of the GNU General Public License version 2 as
  *  published by the Free Software Foundation.
  *
  *  This program is distributed in the hope that it will be useful, but
@@ -16,13 +16,203 @@
  */
 
 #include "cvs.h"
+#include <pthread.h>
+
+/*
+ * Commits hold their files as a tree, much as git does.  The leaves
+ * are runs of revisions from one directory, each run hash-consed
+ * into a rev_dir so that commits that share a directory's contents
+ * share the rev_dir.  Which masters make up a run is settled once,
+ * when the file revisions are numbered: since indices follow file
+ * names, a run is just a stretch of masters with the same directory,
+ * and ordering a commit's files by name is ordering them by index.
+ *
+ * The runs hang off a fixed tree of directories, also built then.
+ * A directory's entries are its runs and its subdirectories, in
+ * file name order; a directory's own files may be split into more
+ * than one run by a subdirectory whose name sorts between them, but
+ * everything under a subdirectory is one stretch of runs.  A commit
+ * holds a rev_tree for each directory with files in it, interned
+ * like the rev_dirs, so a commit shares with its neighbours every
+ * subtree that didn't change.
+ */
+
+static uint32_t	nruns;
+
+typedef struct _dir_entry {
+    uint32_t	id;		/* run, or node if subdir */
+    bool	subdir;
+} dir_entry;
+
+typedef struct _dir_node {
+    const char	*name;		/* path, leading some file's name */
+    size_t	len;
+    uint32_t	parent;
+    int		slot;		/* entry in the parent */
+    int		depth;
+    uint32_t	last;		/* last run in the subtree */
+    int		nentries;
+    int		sentries;
+    dir_entry	*entries;
+} dir_node;
+
+static dir_node	*dir_nodes;
+static uint32_t	ndir_nodes, sdir_nodes;
+static int	dir_depth;	/* of the deepest node */
+static int	dir_width;	/* most entries in one node */
+static uint32_t	*run_node;	/* each run's directory */
+static int	*run_slot;	/* and its entry there */
+static uint32_t	sruns;
+
+static uint32_t	*dir_stack;	/* rev_dir_runs' open directories */
+static int	ndir_stack, sdir_stack;
 
 static int
-compare_names (const void *a, const void *b)
+compare_index (const void *a, const void *b)
 {
-    const rev_file	*af = a, *bf = b;
+    uint32_t	ai = *(const uint32_t *) a, bi = *(const uint32_t *) b;
 
-    return strcmp (af->name, bf->name);
+    return ai < bi ? -1 : ai > bi;
+}
+
+static void
+dir_node_add (uint32_t n, uint32_t id, bool subdir)
+/* append an entry to directory n */
+{
+    dir_node	*node = &dir_nodes[n];
+
+    if (node->nentries == node->sentries) {
+	node->sentries = node->sentries ? node->sentries * 2 : 4;
+	node->entries = xrealloc (node->entries,
+				  node->sentries * sizeof (dir_entry));
+    }
+    node->entries[node->nentries].id = id;
+    node->entries[node->nentries].subdir = subdir;
+    if (++node->nentries > dir_width)
+	dir_width = node->nentries;
+}
+
+static uint32_t
+dir_node_new (uint32_t parent, const char *name, size_t len)
+{
+    dir_node	*node;
+
+    if (ndir_nodes == sdir_nodes) {
+	sdir_nodes = sdir_nodes ? sdir_nodes * 2 : 64;
+	dir_nodes = xrealloc (dir_nodes, sdir_nodes * sizeof (dir_node));
+    }
+    node = &dir_nodes[ndir_nodes];
+    node->name = name;
+    node->len = len;
+    node->parent = parent;
+    node->depth = ndir_nodes ? dir_nodes[parent].depth + 1 : 0;
+    node->slot = ndir_nodes ? dir_nodes[parent].nentries : 0;
+    node->last = 0;
+    node->nentries = node->sentries = 0;
+    node->entries = NULL;
+    if (node->depth > dir_depth)
+	dir_depth = node->depth;
+    if (ndir_nodes)
+	dir_node_add (parent, ndir_nodes, true);
+    return ndir_nodes++;
+}
+
+static void
+dir_free_nodes (void)
+{
+    uint32_t	n;
+
+    for (n = 0; n < ndir_nodes; n++)
+	free (dir_nodes[n].entries);
+    free (dir_nodes);
+    free (run_node);
+    free (run_slot);
+    free (dir_stack);
+    dir_nodes = NULL;
+    run_node = dir_stack = NULL;
+    run_slot = NULL;
+    ndir_nodes = sdir_nodes = sruns = 0;
+    ndir_stack = sdir_stack = 0;
+    dir_depth = dir_width = 0;
+}
+
+static void
+dir_run_add (const char *name, size_t len, uint32_t r)
+/* file into the directory tree run r, of directory name[0..len) */
+{
+    int		sp = ndir_stack;
+    dir_node	*top;
+    size_t	start, end;
+    const char	*slash;
+    int		i;
+
+    /* close the directories this one isn't under */
+    for (;;) {
+	top = &dir_nodes[dir_stack[sp-1]];
+	if (sp == 1 || (top->len < len && name[top->len] == '/' &&
+			!memcmp (top->name, name, top->len)) ||
+	    (top->len == len && !memcmp (top->name, name, len)))
+	    break;
+	sp--;
+    }
+    /* and open the ones between */
+    while (top->len < len) {
+	start = top->len ? top->len + 1 : 0;
+	/* an absolute path or "//" has empty components; skip them */
+	while (start < len && name[start] == '/')
+	    start++;
+	slash = memchr (name + start, '/', len - start);
+	end = slash ? slash - name : len;
+	if (sp == sdir_stack) {
+	    sdir_stack *= 2;
+	    dir_stack = xrealloc (dir_stack, sdir_stack * sizeof (uint32_t));
+	}
+	dir_stack[sp] = dir_node_new (dir_stack[sp-1], name, end);
+	top = &dir_nodes[dir_stack[sp++]];
+    }
+    if (r == sruns) {
+	sruns *= 2;
+	run_node = xrealloc (run_node, sruns * sizeof (uint32_t));
+	run_slot = xrealloc (run_slot, sruns * sizeof (int));
+    }
+    run_node[r] = dir_stack[sp-1];
+    run_slot[r] = dir_nodes[dir_stack[sp-1]].nentries;
+    dir_node_add (dir_stack[sp-1], r, false);
+    for (i = 0; i < sp; i++)
+	dir_nodes[dir_stack[i]].last = r;
+    ndir_stack = sp;
+}
+
+void
+rev_dir_runs (rev_file **files, uint32_t nfile)
+/* assign directory runs to the numbered file revisions */
+{
+    char	*name = NULL, *slash;
+    size_t	dirlen = 0, len;
+    uint32_t	i;
+
+    dir_free_nodes ();
+    sruns = sdir_stack = 16;
+    run_node = xmalloc (sruns * sizeof (uint32_t));
+    run_slot = xmalloc (sruns * sizeof (int));
+    dir_stack = xmalloc (sdir_stack * sizeof (uint32_t));
+    dir_stack[0] = dir_node_new (0, "", 0);
+    ndir_stack = 1;
+    nruns = 0;
+    for (i = 0; i < nfile; i++) {
+	if (files[i]->name != name) {
+	    slash = strrchr (files[i]->name, '/');
+	    len = slash ? slash - files[i]->name : 0;
+	    while (len && files[i]->name[len-1] == '/')
+		len--;
+	    if (!name || len != dirlen ||
+		strncmp (files[i]->name, name, len) != 0)
+		dir_run_add (files[i]->name, len, nruns++);
+	    name = files[i]->name;
+	    dirlen = len;
+	}
+	files[i]->dir = nruns - 1;
+    }
 }
 
 #define REV_DIR_HASH	288361
@@ -35,14 +225,47 @@ typedef struct _rev_dir_hash {
 
 static rev_dir_hash	*buckets[REV_DIR_HASH];
 
-static 
-unsigned long hash_files (rev_file **files, int nfiles)
+/*
+ * A rev_tree has an entry for each entry of its directory, NULL
+ * where the run or subdirectory holds no files.
+ */
+typedef union _rev_tree_entry {
+    rev_dir		*dir;
+    struct _rev_tree	*tree;
+} rev_tree_entry;
+
+struct _rev_tree {
+    uint32_t		node;		/* in dir_nodes */
+    int			ndirs;		/* rev_dirs in the subtree */
+    rev_tree_entry	entries[0];
+};
+
+typedef struct _rev_tree_hash {
+    struct _rev_tree_hash   *next;
+    unsigned long	    hash;
+    rev_tree		    tree;
+} rev_tree_hash;
+
+static rev_tree_hash	*tree_buckets[REV_DIR_HASH];
+
+/*
+ * Branches are merged on several threads at once, all packing into
+ * the same tables; a stripe of locks covers the buckets of both.
+ */
+#define REV_DIR_LOCKS	64
+
+static pthread_mutex_t	dir_locks[REV_DIR_LOCKS] = {
+    [0 ... REV_DIR_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+static
+unsigned long hash_files (uint32_t *files, int nfiles)
 {
     unsigned long   h = 0;
     int		    i;
 
     for (i = 0; i < nfiles; i++)
-	h = ((h << 1) | (h >> (sizeof (h) * 8 - 1))) ^ (unsigned long) files[i];
+	h = ((h << 1) | (h >> (sizeof (h) * 8 - 1))) ^ files[i];
     return h;
 }
 
@@ -52,31 +275,78 @@ static int	total_dirs = 0;
  * Take a collection of file revisions and pack them together
  */
 static rev_dir *
-rev_pack_dir (rev_file **files, int nfiles)
+rev_pack_dir (uint32_t *files, int nfiles)
 {
     unsigned long   hash = hash_files (files, nfiles);
     rev_dir_hash    **bucket = &buckets[hash % REV_DIR_HASH];
+    pthread_mutex_t *lock = &dir_locks[hash % REV_DIR_HASH % REV_DIR_LOCKS];
     rev_dir_hash    *h;
 
+    pthread_mutex_lock (lock);
     for (h = *bucket; h; h = h->next) {
 	if (h->hash == hash && h->dir.nfiles == nfiles &&
-	    !memcmp (files, h->dir.files, nfiles * sizeof (rev_file *)))
+	    !memcmp (files, h->dir.files, nfiles * sizeof (uint32_t)))
 	{
+	    pthread_mutex_unlock (lock);
 	    return &h->dir;
 	}
     }
-    h = malloc (sizeof (rev_dir_hash) + nfiles * sizeof (rev_file *));
-    h->next = *bucket;
-    *bucket = h;
+    h = malloc (sizeof (rev_dir_hash) + nfiles * sizeof (uint32_t));
+    mem_charge (MEM_DIR, 1, sizeof (rev_dir_hash) + nfiles * sizeof (uint32_t));
     h->hash = hash;
     h->dir.nfiles = nfiles;
-    memcpy (h->dir.files, files, nfiles * sizeof (rev_file *));
-    total_dirs++;
+    memcpy (h->dir.files, files, nfiles * sizeof (uint32_t));
+    h->next = *bucket;
+    *bucket = h;
+    pthread_mutex_unlock (lock);
+    __atomic_add_fetch (&total_dirs, 1, __ATOMIC_RELAXED);
     return &h->dir;
 }
 
-static int	    sds = 0;
-static rev_dir **rds = NULL;
+static rev_tree *
+rev_pack_tree (uint32_t n, rev_tree_entry *entries)
+/* intern directory n with these entries; NULL if it holds no files */
+{
+    dir_node	    *node = &dir_nodes[n];
+    size_t	    size = node->nentries * sizeof (rev_tree_entry);
+    unsigned long   hash = n;
+    rev_tree_hash   **bucket;
+    pthread_mutex_t *lock;
+    rev_tree_hash   *h;
+    int		    i, ndirs = 0;
+
+    for (i = 0; i < node->nentries; i++) {
+	if (node->entries[i].subdir)
+	    ndirs += entries[i].tree ? entries[i].tree->ndirs : 0;
+	else
+	    ndirs += entries[i].dir != NULL;
+	hash = ((hash << 1) | (hash >> (sizeof (hash) * 8 - 1))) ^
+	    (unsigned long) (uintptr_t) entries[i].dir;
+    }
+    if (!ndirs)
+	return NULL;
+    bucket = &tree_buckets[hash % REV_DIR_HASH];
+    lock = &dir_locks[hash % REV_DIR_HASH % REV_DIR_LOCKS];
+    pthread_mutex_lock (lock);
+    for (h = *bucket; h; h = h->next) {
+	if (h->hash == hash && h->tree.node == n &&
+	    !memcmp (entries, h->tree.entries, size))
+	{
+	    pthread_mutex_unlock (lock);
+	    return &h->tree;
+	}
+    }
+    h = malloc (sizeof (rev_tree_hash) + size);
+    mem_charge (MEM_DIR, 1, sizeof (rev_tree_hash) + size);
+    h->hash = hash;
+    h->tree.node = n;
+    h->tree.ndirs = ndirs;
+    memcpy (h->tree.entries, entries, size);
+    h->next = *bucket;
+    *bucket = h;
+    pthread_mutex_unlock (lock);
+    return &h->tree;
+}
 
 void
 rev_free_dirs (void)
@@ -85,71 +355,358 @@ rev_free_dirs (void)
 
     for (hash = 0; hash < REV_DIR_HASH; hash++) {
 	rev_dir_hash    **bucket = &buckets[hash];
+	rev_tree_hash   **tbucket = &tree_buckets[hash];
 	rev_dir_hash	*h;
+	rev_tree_hash	*th;
 
 	while ((h = *bucket)) {
 	    *bucket = h->next;
+	    mem_charge (MEM_DIR, -1, -(long) (sizeof (rev_dir_hash) +
+					       h->dir.nfiles * sizeof (uint32_t)));
 	    free (h);
 	}
+	while ((th = *tbucket)) {
+	    *tbucket = th->next;
+	    mem_charge (MEM_DIR, -1, -(long) (sizeof (rev_tree_hash) +
+					       dir_nodes[th->tree.node].nentries *
+					       sizeof (rev_tree_entry)));
+	    free (th);
+	}
     }
-    if (rds) {
-	free (rds);
-	rds = NULL;
-	sds = 0;
-    }
+    dir_free_nodes ();
+}
+
+static int
+rev_tree_flatten (rev_tree *tree, rev_dir **rds, int n)
+{
+    dir_node	*node = &dir_nodes[tree->node];
+    int		i;
+
+    for (i = 0; i < node->nentries; i++)
+	if (node->entries[i].subdir) {
+	    if (tree->entries[i].tree)
+		n = rev_tree_flatten (tree->entries[i].tree, rds, n);
+	} else if (tree->entries[i].dir)
+	    rds[n++] = tree->entries[i].dir;
+    return n;
 }
 
 rev_dir **
-rev_pack_files (rev_file **files, int nfiles, int *ndr)
-{
-    char    *dir = 0;
-    char    *slash;
-    int	    dirlen = 0;
-    int	    i;
-    int	    start = 0;
-    int	    nds = 0;
-    rev_dir *rd;
-    
-    if (!rds)
-	rds = malloc ((sds = 16) * sizeof (rev_dir *));
-	
+rev_tree_dirs (rev_tree *tree, int *ndirs)
+/* the rev_dirs of a tree in file order, in an array to free() */
+{
+    rev_dir	**rds;
+
+    if (!tree) {
+	*ndirs = 0;
+	return NULL;
+    }
+    rds = xmalloc (tree->ndirs * sizeof (rev_dir *));
+    *ndirs = rev_tree_flatten (tree, rds, 0);
+    return rds;
+}
+
+static rev_tree *
+rev_tree_node (rev_tree *root, uint32_t n)
+/* the subtree of root for directory n, or NULL if it holds no files */
+{
+    rev_tree	*tree;
+
+    if (n == 0)
+	return root;
+    tree = rev_tree_node (root, dir_nodes[n].parent);
+    return tree ? tree->entries[dir_nodes[n].slot].tree : NULL;
+}
+
+bool
+rev_tree_has_file (rev_tree *tree, rev_file *f)
+/* whether a tree holds a file revision, found down the path to its run */
+{
+    rev_dir	*dir;
+
+    tree = rev_tree_node (tree, run_node[f->dir]);
+    if (!tree)
+	return false;
+    dir = tree->entries[run_slot[f->dir]].dir;
+    return dir && bsearch (&f->index, dir->files, dir->nfiles,
+			   sizeof (uint32_t), compare_index);
+}
+
+static rev_tree *
+rev_pack_subtree (uint32_t n, uint32_t *runs, rev_dir **rds, int nds, int *pos)
+/* intern directory n from the runs, in order, starting at *pos */
+{
+    dir_node	    *node = &dir_nodes[n];
+    rev_tree_entry  *entries;
+    rev_tree	    *tree;
+    dir_entry	    *e;
+    int		    i;
+
+    entries = xmalloc ((node->nentries ? node->nentries : 1) *
+		       sizeof (rev_tree_entry));
+    for (i = 0; i < node->nentries; i++) {
+	e = &node->entries[i];
+	if (!e->subdir)
+	    entries[i].dir = *pos < nds && runs[*pos] == e->id ?
+		rds[(*pos)++] : NULL;
+	else if (*pos < nds && runs[*pos] <= dir_nodes[e->id].last)
+	    entries[i].tree = rev_pack_subtree (e->id, runs, rds, nds, pos);
+	else
+	    entries[i].tree = NULL;
+    }
+    tree = rev_pack_tree (n, entries);
+    free (entries);
+    return tree;
+}
+
+rev_tree *
+rev_pack_files (uint32_t *files, int nfiles)
+/* pack a collection of file revisions into a tree */
+{
+    uint32_t	*runs;
+    rev_dir	**rds;
+    rev_tree	*tree;
+    int		i, start = 0, nds = 0, pos = 0;
+
     /* order by name */
-    qsort (files, nfiles, sizeof (rev_file *), compare_names);
+    qsort (files, nfiles, sizeof (uint32_t), compare_index);
 
     /* pull out directories */
-    for (i = 0; i < nfiles; i++) {
-	if (!dir || strncmp (files[i]->name, dir, dirlen) != 0)
+    runs = xmalloc ((nfiles ? nfiles : 1) * sizeof (uint32_t));
+    rds = xmalloc ((nfiles ? nfiles : 1) * sizeof (rev_dir *));
+    for (i = 1; i <= nfiles; i++)
+	if (i == nfiles || rev_files[files[i]]->dir != rev_files[files[start]]->dir)
 	{
-	    if (i > start) {
-		rd = rev_pack_dir (files + start, i - start);
-		if (nds == sds) {
-		    rds = realloc (rds, (sds *= 2) * sizeof (rev_dir *));
-		    if (rds == NULL) {
-			free(rds);
-			exit(1);
-		    }
-		}
-		rds[nds++] = rd;
-	    }
+	    runs[nds] = rev_files[files[start]]->dir;
+	    rds[nds++] = rev_pack_dir (files + start, i - start);
 	    start = i;
-	    dir = files[i]->name;
-	    slash = strrchr (dir, '/');
-	    if (slash)
-		dirlen = slash - dir;
-	    else
-		dirlen = 0;
 	}
+
+    tree = rev_pack_subtree (0, runs, rds, nds, &pos);
+    free (runs);
+    free (rds);
+    return tree;
+}
+
+/*
+ * While a branch is being merged, each commit differs from the one
+ * before it by only a few files.  A rev_dir_set follows those
+ * changes run by run, so that building a commit only repacks the
+ * runs that changed and the directories above them, and takes the
+ * rest of the tree as it was.
+ */
+
+#define NO_NODE	UINT32_MAX
+
+typedef struct _rev_dir_run {
+    uint32_t	*files;		/* present revisions, in index order */
+    int		nfiles;
+    int		sfiles;
+    rev_dir	*dir;		/* the packed files, unless stale */
+    bool	stale;
+} rev_dir_run;
+
+struct _rev_dir_set {
+    rev_dir_run	*runs;		/* indexed by rev_file.dir */
+    uint32_t	*stale;		/* runs changed since the last pack */
+    int		nstale;
+    rev_tree	**trees;	/* each directory, as last packed */
+    bool	*touched;	/* directories to repack, */
+    uint32_t	*next_stale;	/* listed by depth */
+    uint32_t	*stale_nodes;
+    rev_tree_entry *entries;	/* room for the widest directory */
+    int		nfiles;		/* in all runs */
+};
+
+rev_dir_set *
+rev_dir_set_new (void)
+{
+    rev_dir_set	*set = xmalloc (sizeof (rev_dir_set));
+    int		d;
+
+    set->runs = calloc (nruns ? nruns : 1, sizeof (rev_dir_run));
+    set->stale = xmalloc ((nruns ? nruns : 1) * sizeof (uint32_t));
+    set->trees = calloc (ndir_nodes, sizeof (rev_tree *));
+    set->touched = calloc (ndir_nodes, sizeof (bool));
+    set->next_stale = xmalloc (ndir_nodes * sizeof (uint32_t));
+    set->stale_nodes = xmalloc ((dir_depth + 1) * sizeof (uint32_t));
+    for (d = 0; d <= dir_depth; d++)
+	set->stale_nodes[d] = NO_NODE;
+    set->entries = xmalloc ((dir_width ? dir_width : 1) *
+			    sizeof (rev_tree_entry));
+    set->nstale = set->nfiles = 0;
+    return set;
+}
+
+void
+rev_dir_set_free (rev_dir_set *set)
+{
+    uint32_t	r;
+
+    for (r = 0; r < nruns; r++)
+	free (set->runs[r].files);
+    free (set->runs);
+    free (set->stale);
+    free (set->trees);
+    free (set->touched);
+    free (set->next_stale);
+    free (set->stale_nodes);
+    free (set->entries);
+    free (set);
+}
+
+static void
+rev_dir_set_forget (rev_dir_set *set, rev_tree *tree)
+/* empty the runs and directories of a packed tree */
+{
+    dir_node	*node = &dir_nodes[tree->node];
+    dir_entry	*e;
+    int		i;
+
+    set->trees[tree->node] = NULL;
+    for (i = 0; i < node->nentries; i++) {
+	e = &node->entries[i];
+	if (e->subdir) {
+	    if (tree->entries[i].tree)
+		rev_dir_set_forget (set, tree->entries[i].tree);
+	} else if (tree->entries[i].dir) {
+	    set->runs[e->id].nfiles = 0;
+	    set->runs[e->id].dir = NULL;
+	}
+    }
+}
+
+void
+rev_dir_set_clear (rev_dir_set *set)
+/* empty the set, keeping its buffers */
+{
+    rev_dir_run	*run;
+    uint32_t	n;
+    int		i, d;
+
+    if (set->trees[0])
+	rev_dir_set_forget (set, set->trees[0]);
+    for (i = 0; i < set->nstale; i++) {
+	run = &set->runs[set->stale[i]];
+	run->nfiles = 0;
+	run->dir = NULL;
+	run->stale = false;
     }
-    rd = rev_pack_dir (files + start, nfiles - start);
-    if (nds == sds) {
-	rds = realloc (rds, (sds *= 2) * sizeof (rev_dir *));
-	if (rds == NULL) {
-	    free(rds);
-	    exit(1);
+    for (d = 0; d <= dir_depth; d++) {
+	for (n = set->stale_nodes[d]; n != NO_NODE; n = set->next_stale[n])
+	    set->touched[n] = false;
+	set->stale_nodes[d] = NO_NODE;
+    }
+    set->nstale = set->nfiles = 0;
+}
+
+static int
+rev_dir_search (uint32_t *v, int n, uint32_t key)
+/* position of key in the sorted array v, or where it would go */
+{
+    int	lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) / 2;
+	if (v[mid] < key)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+void
+rev_dir_set_change (rev_dir_set *set, rev_file *old, rev_file *new)
+/* replace revision old with new; either may be NULL */
+{
+    uint32_t	    r;
+    rev_dir_run	    *run;
+    int		    i;
+
+    if (old == new)
+	return;
+    r = old ? old->dir : new->dir;
+    run = &set->runs[r];
+    if (old && new) {
+	assert (old->dir == new->dir);
+	i = rev_dir_search (run->files, run->nfiles, old->index);
+	assert (i < run->nfiles && run->files[i] == old->index);
+	run->files[i] = new->index;
+    } else if (new) {
+	if (run->nfiles == run->sfiles) {
+	    run->sfiles = run->sfiles ? run->sfiles * 2 : 4;
+	    run->files = xrealloc (run->files, run->sfiles * sizeof (uint32_t));
 	}
+	i = rev_dir_search (run->files, run->nfiles, new->index);
+	memmove (run->files + i + 1, run->files + i,
+		 (run->nfiles - i) * sizeof (uint32_t));
+	run->files[i] = new->index;
+	run->nfiles++;
+	set->nfiles++;
+    } else {
+	i = rev_dir_search (run->files, run->nfiles, old->index);
+	assert (i < run->nfiles && run->files[i] == old->index);
+	memmove (run->files + i, run->files + i + 1,
+		 (run->nfiles - i - 1) * sizeof (uint32_t));
+	run->nfiles--;
+	set->nfiles--;
     }
-    rds[nds++] = rd;
-    
-    *ndr = nds;
-    return rds;
+    if (!run->stale) {
+	run->stale = true;
+	set->stale[set->nstale++] = r;
+    }
+}
+
+static void
+rev_dir_set_touch (rev_dir_set *set, uint32_t n)
+/* mark directory n for repacking */
+{
+    int	d = dir_nodes[n].depth;
+
+    if (set->touched[n])
+	return;
+    set->touched[n] = true;
+    set->next_stale[n] = set->stale_nodes[d];
+    set->stale_nodes[d] = n;
+}
+
+rev_tree *
+rev_dir_set_pack (rev_dir_set *set, int *nfiles)
+/* the tree of the current contents */
+{
+    rev_dir_run	*run;
+    dir_node	*node;
+    rev_tree	*tree;
+    uint32_t	n;
+    int		i, d;
+
+    for (i = 0; i < set->nstale; i++) {
+	run = &set->runs[set->stale[i]];
+	run->dir = run->nfiles ? rev_pack_dir (run->files, run->nfiles) : NULL;
+	run->stale = false;
+	rev_dir_set_touch (set, run_node[set->stale[i]]);
+    }
+    set->nstale = 0;
+    /* deepest first, so each directory sees its subtrees repacked */
+    for (d = dir_depth; d >= 0; d--) {
+	for (n = set->stale_nodes[d]; n != NO_NODE; n = set->next_stale[n]) {
+	    set->touched[n] = false;
+	    node = &dir_nodes[n];
+	    for (i = 0; i < node->nentries; i++)
+		if (node->entries[i].subdir)
+		    set->entries[i].tree = set->trees[node->entries[i].id];
+		else
+		    set->entries[i].dir = set->runs[node->entries[i].id].dir;
+	    tree = rev_pack_tree (n, set->entries);
+	    if (tree != set->trees[n]) {
+		set->trees[n] = tree;
+		if (d > 0)
+		    rev_dir_set_touch (set, node->parent);
+	    }
+	}
+	set->stale_nodes[d] = NO_NODE;
+    }
+    *nfiles = set->nfiles;
+    return set->trees[0];
 }
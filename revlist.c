@@ -17,6 +17,7 @@
  */
 
 #include "cvs.h"
+#include <pthread.h>
 
 /*
  * Add head refs
@@ -39,6 +40,7 @@ rev_list_add_head (rev_list *rl, rev_commit *commit, char *name, int degree)
     return r;
 }
 
+#ifdef __UNUSED__
 static rev_ref *
 rev_find_head (rev_list *rl, char *name)
 {
@@ -49,13 +51,146 @@ rev_find_head (rev_list *rl, char *name)
 	    return h;
     return NULL;
 }
+#endif
+
+/*
+ * While merging, every branch name is looked up in the merged list
+ * and in each master's list, again and again.  Rather than scanning
+ * those lists, rev_list_merge first indexes the names: each gets the
+ * merged ref made for it and the masters' refs of that name in list
+ * order.  Names are atoms, so the open-addressed table is keyed on
+ * their address; a head left unnamed is filed under NULL.
+ */
+
+typedef struct _rev_branch {
+    char	*name;
+    rev_ref	*head;		/* in the merged list */
+    rev_ref	**refs;		/* one per master that has the branch */
+    int		nref;
+    int		sref;
+    rev_list	*last;		/* the list refs[nref-1] came from */
+    int		pos;		/* in the heads, for rev_ref_tsort */
+} rev_branch;
+
+static rev_branch   *branches;
+static unsigned	    nbranches, sbranches;
+
+static unsigned
+rev_branch_hash (char *name)
+{
+    uint64_t	x = (uintptr_t) name;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned) x;
+}
+
+static rev_branch *
+rev_branch_slot (char *name)
+/* the entry for name, or the empty one where it would go */
+{
+    unsigned	mask = sbranches - 1;
+    unsigned	i = rev_branch_hash (name) & mask;
+
+    while (branches[i].head && branches[i].name != name)
+	i = (i + 1) & mask;
+    return &branches[i];
+}
+
+static rev_branch *
+rev_branch_find (char *name)
+{
+    rev_branch	*b = rev_branch_slot (name);
+
+    return b->head ? b : NULL;
+}
+
+static void
+rev_branch_grow (void)
+/* double the index, rehashing what's there */
+{
+    rev_branch	*old = branches;
+    unsigned	oldsize = sbranches, i;
+
+    sbranches = oldsize ? oldsize * 2 : 256;
+    branches = calloc (sbranches, sizeof (rev_branch));
+    for (i = 0; i < oldsize; i++)
+	if (old[i].head)
+	    *rev_branch_slot (old[i].name) = old[i];
+    free (old);
+}
+
+static void
+rev_branch_index (rev_list *rl, rev_list *lists)
+/* make rl's heads, one per branch name in lists, and index them */
+{
+    rev_list	*l;
+    rev_ref	*lh, *h, **tail = &rl->heads;
+    rev_branch	*b;
+
+    for (l = lists; l; l = l->next) {
+	for (lh = l->heads; lh; lh = lh->next) {
+	    if (2 * (nbranches + 1) > sbranches)
+		rev_branch_grow ();
+	    b = rev_branch_slot (lh->name);
+	    if (!b->head) {
+		h = calloc (1, sizeof (rev_ref));
+		h->name = lh->name;
+		h->degree = lh->degree;
+		*tail = h;
+		tail = &h->next;
+		b->name = lh->name;
+		b->head = h;
+		nbranches++;
+	    } else if (lh->degree > b->head->degree)
+		b->head->degree = lh->degree;
+	    /* if a list has two heads of a name, the first one wins */
+	    if (b->last == l)
+		continue;
+	    if (b->nref == b->sref) {
+		b->sref = b->sref ? b->sref * 2 : 4;
+		b->refs = xrealloc (b->refs, b->sref * sizeof (rev_ref *));
+	    }
+	    b->refs[b->nref++] = lh;
+	    b->last = l;
+	}
+    }
+}
+
+static void
+rev_branch_index_free (void)
+{
+    unsigned	i;
+
+    for (i = 0; i < sbranches; i++)
+	free (branches[i].refs);
+    free (branches);
+    branches = NULL;
+    nbranches = sbranches = 0;
+}
 
 /*
  * We keep all file lists in a canonical sorted order,
- * first by latest date and then by the address of the rev_file object
- * (which are always unique)
+ * first by latest date and then by file name and revision,
+ * which is the order rev_list_index_files numbers them in.
+ * Addresses would do to break ties, but they depend on how
+ * the loader threads happened to interleave.
  */
 
+static int
+rev_file_order (rev_file *af, rev_file *bf)
+/* date-independent total order on file revisions */
+{
+    if (af == bf)
+	return 0;
+    if (!af)
+	return -1;
+    if (!bf)
+	return 1;
+    return af->index < bf->index ? -1 : 1;
+}
+
 bool
 rev_file_later (rev_file *af, rev_file *bf)
 {
@@ -73,7 +208,7 @@ rev_file_later (rev_file *af, rev_file *bf)
 	return true;
     if (t < 0)
 	return false;
-    if ((uintptr_t) af > (uintptr_t) bf)
+    if (rev_file_order (af, bf) > 0)
 	return true;
     return false;
 }
@@ -89,7 +224,7 @@ rev_commit_later (rev_commit *a, rev_commit *b)
 	return true;
     if (t < 0)
 	return false;
-    if ((uintptr_t) a > (uintptr_t) b)
+    if (rev_file_order (a->file, b->file) > 0)
 	return true;
     return true;
 }
@@ -132,15 +267,17 @@ rev_commit_match (rev_commit *a, rev_commit *b)
 static void
 rev_commit_dump (FILE *f, char *title, rev_commit *c, rev_commit *m)
 {
+    char	when[CTIME_LEN];
+
     fprintf (f, "\n%s\n", title);
     while (c) {
 	int	i;
 
 	fprintf (f, "%c0x%x %s\n", c == m ? '>' : ' ',
-		(int) c, ctime_nonl (&c->date));
+		(int) c, ctime_nonl (&c->date, when));
 	for (i = 0; i < c->nfiles; i++) {
-	    fprintf (f, "\t%s", ctime_nonl (&c->files[i]->date));
-	    dump_number_file (f, c->files[i]->name, &c->files[i]->number);
+	    fprintf (f, "\t%s", ctime_nonl (&c->files[i]->date, when));
+	    dump_number_file (f, c->files[i]->name, c->files[i]->number);
 	    fprintf (f, "\n");
 	}
 	fprintf (f, "\n");
@@ -250,55 +387,156 @@ rev_ref_sel_sort (rev_ref *r)
 }
 #endif
 
-static rev_ref *
-rev_ref_find_name (rev_ref *h, char *name)
+/*
+ * Order the merged heads so that every branch comes after all of
+ * the branches it sprouts from in any master.  The parent links are
+ * turned into edges between the index entries and sorted with Kahn's
+ * algorithm.  Of the branches that are ready, the one that came
+ * first in refs goes next, so ties keep their original order.
+ */
+
+static void
+rev_ref_heap_push (int *heap, int *n, int v)
+/* add v to a min-heap of positions */
 {
-    for (; h; h = h->next)
-	if (h->name == name)
-	    return h;
-    return NULL;
+    int	i = (*n)++, p;
+
+    while (i > 0 && heap[p = (i - 1) / 2] > v) {
+	heap[i] = heap[p];
+	i = p;
+    }
+    heap[i] = v;
 }
 
 static int
-rev_ref_is_ready (char *name, rev_list *source, rev_ref *ready)
+rev_ref_heap_pop (int *heap, int *n)
+/* remove and return the smallest position */
 {
-    for (; source; source = source->next) {
-	rev_ref *head = rev_find_head(source, name);
-	if (head) {
-	    if (head->parent && !rev_ref_find_name(ready, head->parent->name))
-		    return 0;
-	}
+    int	top = heap[0], v = heap[--*n];
+    int	i = 0, c;
+
+    while ((c = 2 * i + 1) < *n) {
+	if (c + 1 < *n && heap[c + 1] < heap[c])
+	    c++;
+	if (v <= heap[c])
+	    break;
+	heap[i] = heap[c];
+	i = c;
     }
-    return 1;
+    heap[i] = v;
+    return top;
 }
 
-static rev_ref *
-rev_ref_tsort (rev_ref *refs, rev_list *head)
+static void
+rev_ref_report_cycle (rev_branch **order, int norder, int *indegree)
+/* name the branches of one cycle among those left unsorted */
 {
-    rev_ref *done = NULL;
-    rev_ref **done_tail = &done;
-    rev_ref *r, **prev;
+    int		*path = xmalloc (norder * sizeof (int));
+    int		*at = xmalloc (norder * sizeof (int));
+    int		npath = 0, v, p, i;
+    rev_branch	*b;
+
+    for (v = 0; v < norder; v++)
+	at[v] = -1;
+    for (v = 0; indegree[v] == 0; v++)
+	;
+    /*
+     * Anything left unsorted has a parent that is unsorted too, so
+     * climbing through those must come round to a branch again
+     */
+    while (at[v] < 0) {
+	at[v] = npath;
+	path[npath++] = v;
+	b = order[v];
+	for (i = 0; i < b->nref; i++)
+	    if (b->refs[i]->parent) {
+		p = rev_branch_find (b->refs[i]->parent->name)->pos;
+		if (indegree[p]) {
+		    v = p;
+		    break;
+		}
+	    }
+    }
+    fprintf (stderr, "Error: branch cycle:");
+    for (i = at[v]; i < npath; i++)
+	fprintf (stderr, " %s <-", order[path[i]]->name ?
+		 order[path[i]]->name : "(unnamed)");
+    fprintf (stderr, " %s\n", order[v]->name ? order[v]->name : "(unnamed)");
+    free (at);
+    free (path);
+}
 
-//    fprintf (stderr, "Tsort refs:\n");
-    while (refs) {
-	for (prev = &refs; (r = *prev); prev = &(*prev)->next) {
-	    if (rev_ref_is_ready (r->name, head, done)) {
-		break;
+static rev_ref *
+rev_ref_tsort (rev_ref *refs)
+{
+    rev_ref	*done = NULL;
+    rev_ref	**done_tail = &done;
+    rev_ref	*r;
+    rev_branch	**order, *b;
+    int		norder = 0, nedge = 0, nready = 0, nsorted = 0;
+    int		*indegree, *first, *child, *ready;
+    int		i, j, v, p;
+
+    for (r = refs; r; r = r->next)
+	norder++;
+    order = xmalloc (norder * sizeof (rev_branch *));
+    for (r = refs, i = 0; r; r = r->next, i++) {
+	order[i] = rev_branch_find (r->name);
+	order[i]->pos = i;
+    }
+    /* an edge from each parent to its child, counted then laid out */
+    indegree = calloc (norder, sizeof (int));
+    first = calloc (norder + 1, sizeof (int));
+    for (i = 0; i < norder; i++)
+	for (j = 0; j < order[i]->nref; j++)
+	    if (order[i]->refs[j]->parent) {
+		p = rev_branch_find (order[i]->refs[j]->parent->name)->pos;
+		first[p + 1]++;
+		indegree[i]++;
+		nedge++;
 	    }
-	}
-	if (!r) {
-	    fprintf (stderr, "Error: branch cycle\n");
-	    return NULL;
-	}
-	*prev = r->next;
-	*done_tail = r;
-//	fprintf (stderr, "\t%s\n", r->name);
-	r->next = NULL;
-	done_tail = &r->next;
+    for (i = 0; i < norder; i++)
+	first[i + 1] += first[i];
+    child = xmalloc ((nedge ? nedge : 1) * sizeof (int));
+    for (i = 0; i < norder; i++)
+	for (j = 0; j < order[i]->nref; j++)
+	    if (order[i]->refs[j]->parent) {
+		p = rev_branch_find (order[i]->refs[j]->parent->name)->pos;
+		child[first[p]++] = i;
+	    }
+    /* first[p] now marks the end of p's children; step back to the start */
+    for (i = norder; i > 0; i--)
+	first[i] = first[i - 1];
+    first[0] = 0;
+
+    ready = xmalloc ((norder ? norder : 1) * sizeof (int));
+    for (i = 0; i < norder; i++)
+	if (indegree[i] == 0)
+	    rev_ref_heap_push (ready, &nready, i);
+    while (nready) {
+	v = rev_ref_heap_pop (ready, &nready);
+	b = order[v];
+	*done_tail = b->head;
+	done_tail = &b->head->next;
+	nsorted++;
+	for (j = first[v]; j < first[v + 1]; j++)
+	    if (--indegree[child[j]] == 0)
+		rev_ref_heap_push (ready, &nready, child[j]);
+    }
+    *done_tail = NULL;
+    if (nsorted < norder) {
+	rev_ref_report_cycle (order, norder, indegree);
+	done = NULL;
     }
+    free (ready);
+    free (child);
+    free (first);
+    free (indegree);
+    free (order);
     return done;
 }
 
+#ifdef __UNUSED__
 static int
 rev_list_count (rev_list *head)
 {
@@ -309,6 +547,7 @@ rev_list_count (rev_list *head)
     }
     return count;
 }
+#endif
 
 static int
 rev_commit_date_compare (const void *av, const void *bv)
@@ -333,11 +572,6 @@ rev_commit_date_compare (const void *av, const void *bv)
     if (a->nfiles != b->nfiles)
 	return b->nfiles - a->nfiles;
 #endif
-    /*
-     * tailed entries sort next
-     */
-    if (a->tailed != b->tailed)
-	return (int)a->tailed - (int)b->tailed;
     /*
      * Newest entries sort first
      */
@@ -345,13 +579,9 @@ rev_commit_date_compare (const void *av, const void *bv)
     if (t)
 	return t;
     /*
-     * Ensure total order by ordering based on file address
+     * Ensure total order by ordering based on file
      */
-    if ((uintptr_t) a->file > (uintptr_t) b->file)
-	return -1;
-    if ((uintptr_t) a->file < (uintptr_t) b->file)
-	return 1;
-    return 0;
+    return -rev_file_order (a->file, b->file);
 }
 
 static int
@@ -370,17 +600,9 @@ rev_commit_date_sort (rev_commit **commits, int ncommit)
 int
 rev_commit_has_file (rev_commit *c, rev_file *f)
 {
-    int	i, j;
-
     if (!c)
 	return 0;
-    for (i = 0; i < c->ndirs; i++) {
-	rev_dir	*dir = c->dirs[i];
-	for (j = 0; j < dir->nfiles; j++)
-	    if (dir->files[j] == f)
-		return 1;
-    }
-    return 0;
+    return rev_tree_has_file (c->tree, f);
 }
 
 #ifdef __UNUSED__
@@ -396,49 +618,42 @@ rev_commit_find_file (rev_commit *c, char *name)
 }
 #endif
 
-static rev_file **files = NULL;
-static int	    sfiles = 0;
+static size_t	    nrev_files = 0;
+
+/*
+ * Space each merging thread reuses from one branch to the next
+ */
+typedef struct _rev_scratch {
+    uint32_t	*files;		/* rev_commit_build's file list */
+    int		sfiles;
+    rev_dir_set	*dirs;		/* rev_branch_merge's current files */
+} rev_scratch;
+
+static void
+rev_scratch_free (rev_scratch *s)
+{
+    free (s->files);
+    if (s->dirs)
+	rev_dir_set_free (s->dirs);
+}
 
 void
 rev_commit_cleanup (void)
 {
-    if (files) {
-	free (files);
-	files = NULL;
-	sfiles = 0;
-    }
+    mem_charge (MEM_FILE, 0, -(long) (nrev_files * sizeof (rev_file *)));
+    free (rev_files);
+    rev_files = NULL;
+    nrev_files = 0;
 }
 
 static rev_commit *
-rev_commit_build (rev_commit **commits, rev_commit *leader, int ncommit)
+rev_commit_pack (rev_commit *leader, rev_file *first, int nfile,
+		 rev_tree *tree)
 {
-    int		n, nfile;
     rev_commit	*commit;
-    int		nds;
-    rev_dir	**rds;
-    rev_file	*first;
 
-    if (ncommit > sfiles) {
-	free (files);
-	files = 0;
-    }
-    if (!files)
-	files = malloc ((sfiles = ncommit) * sizeof (rev_file *));
-    
-    nfile = 0;
-    for (n = 0; n < ncommit; n++)
-	if (commits[n] && commits[n]->file)
-	    files[nfile++] = commits[n]->file;
-    
-    if (nfile)
-	first = files[0];
-    else
-	first = NULL;
-    
-    rds = rev_pack_files (files, nfile, &nds);
-        
-    commit = calloc (1, sizeof (rev_commit) +
-		     nds * sizeof (rev_dir *));
+    commit = calloc (1, sizeof (rev_commit));
+    mem_charge (MEM_COMMIT, 1, sizeof (rev_commit));
     
     commit->date = leader->date;
     commit->commitid = leader->commitid;
@@ -448,11 +663,42 @@ rev_commit_build (rev_commit **commits, rev_commit *leader, int ncommit)
     commit->file = first;
     commit->nfiles = nfile;
 
-    memcpy (commit->dirs, rds, (commit->ndirs = nds) * sizeof (rev_dir *));
+    commit->tree = tree;
     
     return commit;
 }
 
+static rev_commit *
+rev_commit_build (rev_scratch *s, rev_commit **commits, rev_commit *leader,
+		  int ncommit)
+{
+    int		n, nfile;
+    uint32_t	*files;
+    rev_file	*first;
+
+    if (ncommit > s->sfiles) {
+	free (s->files);
+	s->sfiles = ncommit;
+	s->files = xmalloc (ncommit * sizeof (uint32_t));
+    }
+    files = s->files;
+    
+    nfile = 0;
+    for (n = 0; n < ncommit; n++)
+	if (commits[n] && commits[n]->file) {
+	    assert (rev_files[commits[n]->file->index] == commits[n]->file);
+	    files[nfile++] = commits[n]->file->index;
+	}
+    
+    if (nfile)
+	first = rev_files[files[0]];
+    else
+	first = NULL;
+    
+    return rev_commit_pack (leader, first, nfile,
+			    rev_pack_files (files, nfile));
+}
+
 #ifdef __UNUSED__
 static rev_commit *
 rev_ref_find_commit_file (rev_ref *branch, rev_file *file)
@@ -540,13 +786,14 @@ rev_commit_locate (rev_ref *branch, rev_commit *file)
     return rev_commit_locate_any (branch, file);
 }
 
-rev_ref *
-rev_branch_of_commit (rev_list *rl, rev_commit *commit)
+static rev_ref *
+rev_branch_of_commit_before (rev_list *rl, rev_commit *commit, rev_ref *stop)
+/* the branch holding commit, looking only at those ahead of stop */
 {
     rev_ref	*h;
     rev_commit	*c;
 
-    for (h = rl->heads; h; h = h->next)
+    for (h = rl->heads; h != stop; h = h->next)
     {
 	if (h->tail)
 	    continue;
@@ -560,6 +807,12 @@ rev_branch_of_commit (rev_list *rl, rev_commit *commit)
     return NULL;
 }
 
+rev_ref *
+rev_branch_of_commit (rev_list *rl, rev_commit *commit)
+{
+    return rev_branch_of_commit_before (rl, commit, NULL);
+}
+
 /*
  * Time of first commit along entire history
  */
@@ -571,13 +824,416 @@ rev_commit_first_date (rev_commit *commit)
     return commit->date;
 }
 
+/*
+ * rev_branch_merge walks the per-file branches down together, each
+ * step taking the newest of their cursors along with every cursor
+ * whose commit matches it.  Rather than scanning all the cursors at
+ * every step, it keeps the ones still walking in a max-heap on date,
+ * ties going to the earlier cursor as a scan would have, and in
+ * buckets of commits that can match one another: those with the same
+ * commitid, or those without one that share a log and author.
+ */
+
+typedef struct _rev_bucket {
+    char	*commitid;
+    char	*log;
+    char	*author;
+    int		head;		/* first cursor in it, or -1 */
+    bool	used;
+} rev_bucket;
+
+typedef struct _rev_cluster {
+    char	*commitid;
+    time_t	date, low;	/* newest and oldest member */
+    int		id, chain;
+    int		first, n;	/* its members */
+} rev_cluster;
+
+typedef struct _rev_merge {
+    rev_commit	**commits;	/* cursors, by slot */
+    bool	*tailed;	/* slots that reached the parent branch */
+    int		*heap;		/* slots, newest first */
+    int		nheap;
+    int		*hpos;		/* each slot's place in the heap */
+    rev_bucket	*buckets;
+    unsigned	sbuckets, nbuckets;
+    int		*bucket;	/* each slot's bucket */
+    int		*bnext, *bprev;	/* chains through a bucket */
+    rev_cluster	*clusters;	/* or NULL, when walking the heap */
+    int		nclusters, cluster;
+    rev_commit	**members;	/* commits of each cluster, in slot order */
+    int		*mslot;		/* and the cursor each is on */
+} rev_merge;
+
+static bool
+rev_merge_newer (rev_merge *m, int a, int b)
+{
+    long	t = time_compare (m->commits[a]->date, m->commits[b]->date);
+
+    return t > 0 || (t == 0 && a < b);
+}
+
+static void
+rev_merge_heap_set (rev_merge *m, int i, int slot)
+{
+    m->heap[i] = slot;
+    m->hpos[slot] = i;
+}
+
+static void
+rev_merge_heap_fix (rev_merge *m, int i)
+/* move the cursor at heap position i to where it belongs */
+{
+    int	slot = m->heap[i], p, c;
+
+    while (i > 0 && rev_merge_newer (m, slot, m->heap[p = (i - 1) / 2])) {
+	rev_merge_heap_set (m, i, m->heap[p]);
+	i = p;
+    }
+    while ((c = 2 * i + 1) < m->nheap) {
+	if (c + 1 < m->nheap && rev_merge_newer (m, m->heap[c + 1], m->heap[c]))
+	    c++;
+	if (!rev_merge_newer (m, m->heap[c], slot))
+	    break;
+	rev_merge_heap_set (m, i, m->heap[c]);
+	i = c;
+    }
+    rev_merge_heap_set (m, i, slot);
+}
+
+static unsigned
+rev_bucket_hash (char *commitid, char *log, char *author)
+{
+    uint64_t	x = (uintptr_t) commitid * 0x9e3779b97f4a7c15ULL ^
+		    (uintptr_t) log * 0xbf58476d1ce4e5b9ULL ^
+		    (uintptr_t) author;
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned) x;
+}
+
+static int
+rev_bucket_of (rev_merge *m, rev_commit *c)
+/* find or make the bucket of commits that could match c */
+{
+    char	*commitid = c->commitid;
+    char	*log = commitid ? NULL : c->log;
+    char	*author = commitid ? NULL : c->author;
+    unsigned	mask = m->sbuckets - 1;
+    unsigned	i = rev_bucket_hash (commitid, log, author) & mask;
+    rev_bucket	*b;
+
+    for (;; i = (i + 1) & mask) {
+	b = &m->buckets[i];
+	if (!b->used)
+	    break;
+	if (b->commitid == commitid && b->log == log && b->author == author)
+	    return i;
+    }
+    b->used = true;
+    b->commitid = commitid;
+    b->log = log;
+    b->author = author;
+    b->head = -1;
+    m->nbuckets++;
+    return i;
+}
+
+static void
+rev_bucket_link (rev_merge *m, int slot)
+{
+    int	i = rev_bucket_of (m, m->commits[slot]);
+
+    m->bucket[slot] = i;
+    m->bprev[slot] = -1;
+    m->bnext[slot] = m->buckets[i].head;
+    if (m->bnext[slot] >= 0)
+	m->bprev[m->bnext[slot]] = slot;
+    m->buckets[i].head = slot;
+}
+
+static void
+rev_bucket_rebuild (rev_merge *m)
+/* buckets are never emptied out of the table, so now and then start over */
+{
+    int	i;
+
+    if (4 * (m->nheap + 1) > m->sbuckets)
+	m->sbuckets *= 2;
+    free (m->buckets);
+    m->buckets = calloc (m->sbuckets, sizeof (rev_bucket));
+    m->nbuckets = 0;
+    for (i = 0; i < m->nheap; i++)
+	rev_bucket_link (m, m->heap[i]);
+}
+
+static void
+rev_merge_add (rev_merge *m, int slot)
+/* start following the cursor in slot */
+{
+    if (m->clusters)
+	return;
+    if (2 * (m->nbuckets + 1) > m->sbuckets)
+	rev_bucket_rebuild (m);
+    rev_bucket_link (m, slot);
+    rev_merge_heap_set (m, m->nheap++, slot);
+    rev_merge_heap_fix (m, m->nheap - 1);
+}
+
+static void
+rev_merge_remove (rev_merge *m, int slot)
+/* stop following the cursor in slot */
+{
+    int	i = m->hpos[slot];
+
+    if (m->clusters)
+	return;
+    if (--m->nheap > i) {
+	rev_merge_heap_set (m, i, m->heap[m->nheap]);
+	rev_merge_heap_fix (m, i);
+    }
+    if (m->bprev[slot] >= 0)
+	m->bnext[m->bprev[slot]] = m->bnext[slot];
+    else
+	m->buckets[m->bucket[slot]].head = m->bnext[slot];
+    if (m->bnext[slot] >= 0)
+	m->bprev[m->bnext[slot]] = m->bprev[slot];
+}
+
+static bool
+rev_merge_live (rev_commit *c)
+/* does a cursor that didn't just step keep the walk going? */
+{
+    return c->parent || c->file;
+}
+
+static rev_commit *
+rev_merge_next (rev_merge *m, int *matched, int *nmatch)
+/* the newest cursor leads; the scan took the first of equals */
+{
+    int		lead = m->heap[0], s, n = 0;
+    rev_commit	*latest = m->commits[lead];
+
+    matched[n++] = lead;
+    for (s = m->buckets[m->bucket[lead]].head; s >= 0; s = m->bnext[s])
+	if (s != lead && rev_commit_match (m->commits[s], latest))
+	    matched[n++] = s;
+    *nmatch = n;
+    return latest;
+}
+
+/*
+ * When every commit the cursors will pass has a commitid, the steps
+ * of the walk are known ahead of time: each takes the commits of one
+ * commitid, newest first.  That holds as long as no commitid turns
+ * up twice on one per-file branch, and each commitid's commits are
+ * all newer than those of the next; then the newest cursor is always
+ * on the next commitid and the others on it are exactly its matches.
+ * The clusters are gathered with a hash on the commitid atom and
+ * sorted by date, and the walk takes them in turn.  A branch that
+ * doesn't qualify is walked on the heap.
+ */
+
+static int
+rev_cluster_compare (const void *av, const void *bv)
+{
+    const rev_cluster	*a = av, *b = bv;
+    long		t = time_compare (b->date, a->date);
+
+    if (t)
+	return t < 0 ? -1 : 1;
+    return a->id - b->id;
+}
+
+static void
+rev_merge_cluster (rev_merge *m, int nslot)
+/* set up to walk the cursors by commitid, if they allow it */
+{
+    rev_commit	*c;
+    rev_commit	**ecommit = NULL;
+    int		*eslot = NULL, *ecluster = NULL, *table = NULL, *rank = NULL;
+    rev_cluster	*clusters = NULL, *k;
+    int		nent = 0, nclusters = 0, i, r, slot;
+    unsigned	stable, mask, h;
+
+    m->clusters = NULL;
+    m->members = NULL;
+    m->mslot = NULL;
+    for (slot = 0; slot < nslot; slot++) {
+	c = m->commits[slot];
+	if (!c || m->tailed[slot])
+	    continue;
+	for (; c; c = c->parent) {
+	    if (!c->commitid)
+		return;
+	    nent++;
+	    if (c->tail)
+		break;
+	}
+    }
+    if (!nent)
+	return;
+    ecommit = xmalloc (nent * sizeof (rev_commit *));
+    eslot = xmalloc (nent * sizeof (int));
+    ecluster = xmalloc (nent * sizeof (int));
+    clusters = xmalloc (nent * sizeof (rev_cluster));
+    for (stable = 16; stable < 2 * nent; stable *= 2)
+	;
+    mask = stable - 1;
+    table = xmalloc (stable * sizeof (int));
+    memset (table, 0xff, stable * sizeof (int));
+
+    nent = 0;
+    for (slot = 0; slot < nslot; slot++) {
+	c = m->commits[slot];
+	if (!c || m->tailed[slot])
+	    continue;
+	for (; c; c = c->parent) {
+	    h = ((uintptr_t) c->commitid * 0x9e3779b97f4a7c15ULL) >> 32;
+	    for (h &= mask; table[h] >= 0; h = (h + 1) & mask)
+		if (clusters[table[h]].commitid == c->commitid)
+		    break;
+	    if (table[h] < 0) {
+		k = &clusters[table[h] = nclusters];
+		k->commitid = c->commitid;
+		k->date = k->low = c->date;
+		k->id = nclusters++;
+		k->chain = -1;
+		k->n = 0;
+	    }
+	    k = &clusters[table[h]];
+	    /* twice on one branch: the steps can't be read off */
+	    if (k->chain == slot)
+		goto fail;
+	    k->chain = slot;
+	    if (time_compare (c->date, k->date) > 0)
+		k->date = c->date;
+	    if (time_compare (c->date, k->low) < 0)
+		k->low = c->date;
+	    k->n++;
+	    ecommit[nent] = c;
+	    eslot[nent] = slot;
+	    ecluster[nent++] = k->id;
+	    if (c->tail)
+		break;
+	}
+    }
+
+    qsort (clusters, nclusters, sizeof (rev_cluster), rev_cluster_compare);
+    for (r = 0; r + 1 < nclusters; r++)
+	if (time_compare (clusters[r].low, clusters[r + 1].date) <= 0)
+	    goto fail;
+    rank = xmalloc (nclusters * sizeof (int));
+    for (r = 0; r < nclusters; r++)
+	rank[clusters[r].id] = r;
+    /* each branch must meet the clusters in the order they are taken */
+    for (i = 0; i < nent; i++) {
+	ecluster[i] = rank[ecluster[i]];
+	if (i && eslot[i] == eslot[i - 1] && ecluster[i] <= ecluster[i - 1])
+	    goto fail;
+    }
+
+    for (r = 0, i = 0; r < nclusters; r++) {
+	clusters[r].first = i;
+	i += clusters[r].n;
+	clusters[r].n = 0;
+    }
+    m->members = xmalloc (nent * sizeof (rev_commit *));
+    m->mslot = xmalloc (nent * sizeof (int));
+    for (i = 0; i < nent; i++) {
+	k = &clusters[ecluster[i]];
+	m->members[k->first + k->n] = ecommit[i];
+	m->mslot[k->first + k->n++] = eslot[i];
+    }
+    m->clusters = clusters;
+    m->nclusters = nclusters;
+    m->cluster = 0;
+    clusters = NULL;
+fail:
+    free (rank);
+    free (table);
+    free (clusters);
+    free (ecluster);
+    free (eslot);
+    free (ecommit);
+}
+
+static rev_commit *
+rev_cluster_next (rev_merge *m, int *matched, int *nmatch)
+/* take the next commitid that some cursor is still on */
+{
+    rev_cluster	*k;
+    rev_commit	*c, *latest = NULL;
+    int		i, n;
+
+    for (; m->cluster < m->nclusters; m->cluster++) {
+	k = &m->clusters[m->cluster];
+	n = 0;
+	for (i = k->first; i < k->first + k->n; i++) {
+	    c = m->members[i];
+	    if (m->commits[m->mslot[i]] != c || m->tailed[m->mslot[i]])
+		continue;
+	    matched[n++] = m->mslot[i];
+	    if (!latest || time_compare (c->date, latest->date) > 0)
+		latest = c;
+	}
+	if (n) {
+	    m->cluster++;
+	    *nmatch = n;
+	    return latest;
+	}
+    }
+    *nmatch = 0;
+    return NULL;
+}
+
+/*
+ * A global branch to merge, and what merging it has to report
+ */
+typedef struct _rev_merge_job {
+    rev_ref	*head;
+    rev_ref	**refs;		/* its per-file branches */
+    int		nref;
+    FILE	*err;		/* diagnostics, collected in msg */
+    char	*msg;
+    size_t	nmsg;
+    rev_commit	*lost;		/* branch point that couldn't be found */
+} rev_merge_job;
+
+/*
+ * The cursors as the merge leaves them, for sorting into the order
+ * the parent branch is searched in
+ */
+typedef struct _rev_cursor {
+    rev_commit	*commit;
+    bool	tailed;
+} rev_cursor;
+
+static int
+rev_cursor_compare (const void *av, const void *bv)
+{
+    rev_cursor	*a = *(rev_cursor **) av;
+    rev_cursor	*b = *(rev_cursor **) bv;
+
+    /*
+     * tailed entries sort after the rest, but before NULL ones
+     */
+    if (a->commit && b->commit && a->tailed != b->tailed)
+	return (int) a->tailed - (int) b->tailed;
+    return rev_commit_date_compare (&a->commit, &b->commit);
+}
+
 /*
  * Merge a set of per-file branches into a global branch
  */
 static void
-rev_branch_merge (rev_ref **branches, int nbranch,
-		  rev_ref *branch, rev_list *rl)
+rev_branch_merge (rev_scratch *sc, rev_merge_job *job)
 {
+	rev_ref **branches = job->refs;
+	int nbranch = job->nref;
+	rev_ref *branch = job->head;
 	int nlive;
 	int n;
 	rev_commit *prev = NULL;
@@ -585,8 +1241,16 @@ rev_branch_merge (rev_ref **branches, int nbranch,
 	rev_commit **commits = calloc (nbranch, sizeof (rev_commit *));
 	rev_commit *commit;
 	rev_commit *latest;
-	rev_commit **p;
+	rev_tree *tree;
+	int nfile;
 	time_t start = 0;
+	rev_merge m;
+	int *matched, nmatch, i, s;
+	int nslot = nbranch, npresent, firstslot, nstep = 0, nwalk = 0;
+	bool *killed;
+	bool *tailed = calloc (nbranch, sizeof (bool));
+	rev_cursor *cursors;
+	rev_cursor **order;
 
 	nlive = 0;
 	for (n = 0; n < nbranch; n++) {
@@ -601,7 +1265,7 @@ rev_branch_merge (rev_ref **branches, int nbranch,
 		if (!c)
 			continue;
 		if (branches[n]->tail) {
-			c->tailed = true;
+			tailed[n] = true;
 			continue;
 		}
 		nlive++;
@@ -618,53 +1282,95 @@ rev_branch_merge (rev_ref **branches, int nbranch,
 
 	for (n = 0; n < nbranch; n++) {
 		rev_commit *c = commits[n];
-		if (!c->tailed)
+		if (!tailed[n])
 			continue;
 		if (!start || time_compare(start, c->date) >= 0)
 			continue;
 		if (c->file)
-			fprintf(stderr,
+			fprintf(job->err,
 				"Warning: %s too late date through branch %s\n",
 					c->file->name, branch->name);
 		commits[n] = NULL;
 	}
+	/*
+	 * Each commit is built from the last by following the files
+	 * that change; see rev_dir_set
+	 */
+	if (!sc->dirs)
+		sc->dirs = rev_dir_set_new ();
+	m.commits = commits;
+	m.tailed = tailed;
+	m.heap = xmalloc (nslot * sizeof (int));
+	m.hpos = xmalloc (nslot * sizeof (int));
+	m.bucket = xmalloc (nslot * sizeof (int));
+	m.bnext = xmalloc (nslot * sizeof (int));
+	m.bprev = xmalloc (nslot * sizeof (int));
+	m.nheap = 0;
+	for (m.sbuckets = 16; m.sbuckets < 4 * nslot; m.sbuckets *= 2)
+		;
+	m.buckets = calloc (m.sbuckets, sizeof (rev_bucket));
+	m.nbuckets = 0;
+	matched = xmalloc (nslot * sizeof (int));
+	killed = calloc (nslot, sizeof (bool));
+	rev_merge_cluster (&m, nslot);
+	npresent = 0;
+	firstslot = nslot;
+	for (n = 0; n < nslot; n++) {
+		rev_commit *c = commits[n];
+		if (!c)
+			continue;
+		npresent++;
+		rev_dir_set_change (sc->dirs, NULL, c->file);
+		if (c->file && firstslot == nslot)
+			firstslot = n;
+		if (tailed[n])
+			continue;
+		rev_merge_add (&m, n);
+		if (rev_merge_live (c))
+			nwalk++;
+	}
 	/*
 	 * Walk down branches until each one has merged with the
 	 * parent branch
 	 */
-	while (nlive > 0 && nbranch > 0) {
-		for (n = 0, p = commits, latest = NULL; n < nbranch; n++) {
-			rev_commit *c = commits[n];
-			if (!c)
-				continue;
-			*p++ = c;
-			if (c->tailed)
-				continue;
-			if (!latest || time_compare(latest->date, c->date) < 0)
-				latest = c;
-		}
-		nbranch = p - commits;
+	while (nlive > 0 && npresent > 0) {
+		nbranch = npresent;
+		for (i = 0; i < nstep; i++)
+			killed[matched[i]] = false;
+
+		/*
+		 * Find the cursors that step: the newest and its matches
+		 */
+		if (m.clusters)
+			latest = rev_cluster_next (&m, matched, &nmatch);
+		else
+			latest = rev_merge_next (&m, matched, &nmatch);
+		nstep = nmatch;
 
 		/*
 		 * Construct current commit
 		 */
-		commit = rev_commit_build (commits, latest, nbranch);
+		while (firstslot < nslot &&
+		       !(commits[firstslot] && commits[firstslot]->file))
+			firstslot++;
+		tree = rev_dir_set_pack (sc->dirs, &nfile);
+		commit = rev_commit_pack (latest, firstslot < nslot ?
+					  commits[firstslot]->file : NULL,
+					  nfile, tree);
 
 		/*
 		 * Step each branch
 		 */
-		nlive = 0;
-		for (n = 0; n < nbranch; n++) {
-			rev_commit *c = commits[n];
+		nlive = nwalk;
+		for (i = 0; i < nmatch; i++) {
+			rev_commit *c;
 			rev_commit *to;
-			/* already got to parent branch? */
-			if (c->tailed)
-				continue;
-			/* not affected? */
-			if (c != latest && !rev_commit_match(c, latest)) {
-				if (c->parent || c->file)
-					nlive++;
-				continue;
+			n = matched[i];
+			c = commits[n];
+			rev_merge_remove (&m, n);
+			if (rev_merge_live (c)) {
+				nlive--;
+				nwalk--;
 			}
 			to = c->parent;
 			/* starts here? */
@@ -693,7 +1399,7 @@ rev_branch_merge (rev_ref **branches, int nbranch,
 				 * branch had forked off it but before
 				 * our branch's creation.
 				 */
-				to->tailed = true;
+				tailed[n] = true;
 			} else if (to->file) {
 				nlive++;
 			} else {
@@ -707,24 +1413,67 @@ rev_branch_merge (rev_ref **branches, int nbranch,
 					goto Kill;
 				nlive++;
 			}
+			rev_dir_set_change (sc->dirs, c->file, to->file);
 			commits[n] = to;
+			if (!tailed[n]) {
+				rev_merge_add (&m, n);
+				if (rev_merge_live (to))
+					nwalk++;
+			}
+			if (to->file && n < firstslot)
+				firstslot = n;
 			continue;
 Kill:
+			rev_dir_set_change (sc->dirs, c->file, NULL);
 			commits[n] = NULL;
+			killed[n] = true;
+			npresent--;
 		}
 
 		*tail = commit;
 		tail = &commit->parent;
 		prev = commit;
 	}
+	/*
+	 * Lay the cursors out as the old scan left them: those present
+	 * when the last step began, in order, the ones it killed NULL
+	 */
+	cursors = xmalloc (nslot * sizeof (rev_cursor));
+	order = xmalloc (nslot * sizeof (rev_cursor *));
+	for (n = 0, s = 0; s < nslot; s++)
+		if (!prev || commits[s] || killed[s]) {
+			cursors[n].commit = commits[s];
+			cursors[n].tailed = tailed[s];
+			order[n] = &cursors[n];
+			n++;
+		}
+	nbranch = n;
+	free (tailed);
+	free (killed);
+	free (matched);
+	free (m.clusters);
+	free (m.members);
+	free (m.mslot);
+	free (m.buckets);
+	free (m.bprev);
+	free (m.bnext);
+	free (m.bucket);
+	free (m.hpos);
+	free (m.heap);
     /*
      * Connect to parent branch
      */
-    nbranch = rev_commit_date_sort (commits, nbranch);
+    qsort (order, nbranch, sizeof (rev_cursor *), rev_cursor_compare);
+    for (i = 0; i < nbranch; i++)
+	commits[i] = order[i]->commit;
+    while (nbranch && !commits[nbranch-1])
+	nbranch--;
+    free (order);
+    free (cursors);
     if (nbranch && branch->parent )
     {
-	rev_ref	*lost;
 	int	present;
+	char	when[CTIME_LEN];
 
 //	present = 0;
 	for (present = 0; present < nbranch; present++)
@@ -736,7 +1485,7 @@ Kill:
 		if (prev && commits[present]->date > prev->date &&
 		    commits[present]->date == rev_commit_first_date (commits[present]))
 		{
-		    fprintf (stderr, "Warning: file %s appears after branch %s date\n",
+		    fprintf (job->err, "Warning: file %s appears after branch %s date\n",
 			     commits[present]->file->name, branch->name);
 		    continue;
 		}
@@ -748,48 +1497,131 @@ Kill:
 						 commits[present])))
 	{
 	    if (prev && time_compare ((*tail)->date, prev->date) > 0) {
-		fprintf (stderr, "Warning: branch point %s -> %s later than branch\n",
+		fprintf (job->err, "Warning: branch point %s -> %s later than branch\n",
 			 branch->name, branch->parent->name);
-		fprintf (stderr, "\ttrunk(%3d):  %s %s", n,
-			 ctime_nonl (&commits[present]->date),
+		fprintf (job->err, "\ttrunk(%3d):  %s %s", n,
+			 ctime_nonl (&commits[present]->date, when),
 			 commits[present]->file ? " " : "D" );
 		if (commits[present]->file)
-		    dump_number_file (stderr,
+		    dump_number_file (job->err,
 				      commits[present]->file->name,
-				      &commits[present]->file->number);
-		fprintf (stderr, "\n");
-		fprintf (stderr, "\tbranch(%3d): %s  ", n,
-			 ctime_nonl (&prev->file->date));
-		dump_number_file (stderr,
+				      commits[present]->file->number);
+		fprintf (job->err, "\n");
+		fprintf (job->err, "\tbranch(%3d): %s  ", n,
+			 ctime_nonl (&prev->file->date, when));
+		dump_number_file (job->err,
 				  prev->file->name,
-				  &prev->file->number);
-		fprintf (stderr, "\n");
+				  prev->file->number);
+		fprintf (job->err, "\n");
 	    }
 	} else if ((*tail = rev_commit_locate_date (branch->parent,
 						  commits[present]->date)))
-	    fprintf (stderr, "Warning: branch point %s -> %s matched by date\n",
+	    fprintf (job->err, "Warning: branch point %s -> %s matched by date\n",
 		     branch->name, branch->parent->name);
 	else {
-	    fprintf (stderr, "Error: branch point %s -> %s not found.",
+	    fprintf (job->err, "Error: branch point %s -> %s not found.",
 		     branch->name, branch->parent->name);
-
-	    if ((lost = rev_branch_of_commit (rl, commits[present])))
-		fprintf (stderr, " Possible match on %s.", lost->name);
-	    fprintf (stderr, "\n");
+	    /* rev_merge_report finishes the line */
+	    job->lost = commits[present];
 	}
 	if (*tail) {
 	    if (prev)
 		prev->tail = 1;
 	} else 
-	    *tail = rev_commit_build (commits, commits[0], nbranch);
+	    *tail = rev_commit_build (sc, commits, commits[0], nbranch);
     }
-    for (n = 0; n < nbranch; n++)
-	if (commits[n])
-	    commits[n]->tailed = false;
+    rev_dir_set_clear (sc->dirs);
     free (commits);
     branch->commit = head;
 }
 
+/*
+ * A branch needs only its parent merged before it, so the branches
+ * at each depth of the tree are merged at once by a pool of threads,
+ * each with its own scratch space.  What they have to say is held
+ * until all are done, then printed in tsort order, as it would have
+ * been had they been merged one by one.
+ */
+static struct {
+    pthread_mutex_t	lock;
+    rev_merge_job	**jobs;		/* those at the current depth */
+    int			njob, next;
+} merge_pool = { PTHREAD_MUTEX_INITIALIZER };
+
+static void *
+rev_merge_worker (void *arg)
+/* merge branches at the current depth until none are left */
+{
+    rev_scratch		*sc = arg;
+    rev_merge_job	*job;
+
+    for (;;) {
+	pthread_mutex_lock (&merge_pool.lock);
+	job = merge_pool.next < merge_pool.njob ?
+	      merge_pool.jobs[merge_pool.next++] : NULL;
+	pthread_mutex_unlock (&merge_pool.lock);
+	if (!job)
+	    return NULL;
+	rev_branch_merge (sc, job);
+    }
+}
+
+static void
+rev_merge_jobs (rev_merge_job *jobs, int njob, int nthreads)
+/* merge every job's branch, shallowest first */
+{
+    rev_scratch	*scratch = calloc (nthreads, sizeof (rev_scratch));
+    pthread_t	*workers = xmalloc (nthreads * sizeof (pthread_t));
+    int		depth, maxdepth = 0, nworker, i;
+
+    merge_pool.jobs = xmalloc ((njob ? njob : 1) * sizeof (rev_merge_job *));
+    for (i = 0; i < njob; i++)
+	if (jobs[i].head->depth > maxdepth)
+	    maxdepth = jobs[i].head->depth;
+    for (depth = 1; depth <= maxdepth; depth++) {
+	merge_pool.njob = merge_pool.next = 0;
+	for (i = 0; i < njob; i++)
+	    if (jobs[i].head->depth == depth)
+		merge_pool.jobs[merge_pool.njob++] = &jobs[i];
+	nworker = merge_pool.njob < nthreads ? merge_pool.njob : nthreads;
+	if (nworker <= 1) {
+	    rev_merge_worker (&scratch[0]);
+	    continue;
+	}
+	for (i = 0; i < nworker; i++)
+	    if (pthread_create (&workers[i], NULL, rev_merge_worker,
+				&scratch[i]) != 0) {
+		perror ("pthread_create");
+		exit (1);
+	    }
+	for (i = 0; i < nworker; i++)
+	    pthread_join (workers[i], NULL);
+    }
+    for (i = 0; i < nthreads; i++)
+	rev_scratch_free (&scratch[i]);
+    free (merge_pool.jobs);
+    merge_pool.jobs = NULL;
+    free (workers);
+    free (scratch);
+}
+
+static void
+rev_merge_report (rev_list *rl, rev_merge_job *job)
+/* print what merging a branch had to say */
+{
+    rev_ref	*lost;
+
+    fclose (job->err);
+    fwrite (job->msg, 1, job->nmsg, stderr);
+    free (job->msg);
+    if (!job->lost)
+	return;
+    /* a serial merge would only have had the branches before this one */
+    if ((lost = rev_branch_of_commit_before (rl, job->lost, job->head)))
+	fprintf (stderr, " Possible match on %s.", lost->name);
+    fprintf (stderr, "\n");
+}
+
 /*
  * Locate position in tree corresponding to specific tag
  */
@@ -811,33 +1643,33 @@ rev_tag_search(Tag *tag, rev_commit **commits, rev_list *rl)
 		 * doing somethging wacky to the DAG.
 		 */
 		/* AV: shouldn't we put it on some branch? */
-		tag->commit = rev_commit_build(commits, commits[0], tag->count);
+		tag->commit = rev_commit_build(NULL, commits, commits[0], tag->count);
 #endif
 	}
 	tag->commit->tagged = (tag->commit != NULL);
 }
 
 static void
-rev_ref_set_parent (rev_list *rl, rev_ref *dest, rev_list *source)
+rev_ref_set_parent (rev_ref *dest)
 {
+    rev_branch	*b;
     rev_ref	*sh;
-    rev_list	*s;
     rev_ref	*p;
     rev_ref	*max;
+    int		i;
 
     if (dest->depth)
 	return;
 
     max = NULL;
-    for (s = source; s; s = s->next) {
-	sh = rev_find_head (s, dest->name);
-	if (!sh)
-	    continue;
+    b = rev_branch_find (dest->name);
+    for (i = 0; i < b->nref; i++) {
+	sh = b->refs[i];
 	if (!sh->parent)
 	    continue;
-	p = rev_find_head (rl, sh->parent->name);
+	p = rev_branch_find (sh->parent->name)->head;
 	assert (p);
-	rev_ref_set_parent (rl, p, source);
+	rev_ref_set_parent (p);
 	if (!max || p->depth > max->depth)
 	    max = p;
     }
@@ -921,37 +1753,93 @@ rev_ref_parent (rev_ref **refs, int nref, rev_list *rl)
 }
 #endif
 
+/*
+ * Number every live file revision, so that rev_dir can refer to
+ * them with 32-bit indices and ties can be broken by comparing
+ * those.  Masters are taken in name order; each has already put
+ * its own revisions in number order.
+ */
+
+rev_file	**rev_files;
+
+typedef struct _rev_list_order {
+    rev_list	*rl;
+    int		pos;
+} rev_list_order;
+
+static int
+rev_list_name_compare (const void *a, const void *b)
+{
+    const rev_list_order *ao = a, *bo = b;
+    int			 t;
+
+    if (!ao->rl->nfiles || !bo->rl->nfiles)
+	t = !!ao->rl->nfiles - !!bo->rl->nfiles;
+    else
+	t = strcmp (ao->rl->files[0]->name, bo->rl->files[0]->name);
+    return t ? t : ao->pos - bo->pos;
+}
+
+static void
+rev_list_index_files (rev_list *lists)
+{
+    rev_list_order  *order;
+    rev_list	    *l;
+    size_t	    nfile = 0;
+    uint32_t	    index = 0;
+    int		    nlist = 0, i, j;
+
+    for (l = lists; l; l = l->next) {
+	nfile += l->nfiles;
+	nlist++;
+    }
+    if (nfile > UINT32_MAX) {
+	fprintf (stderr, "too many file revisions (%lu)\n",
+		 (unsigned long) nfile);
+	exit (1);
+    }
+    order = xmalloc (nlist * sizeof (rev_list_order));
+    for (l = lists, i = 0; l; l = l->next, i++) {
+	order[i].rl = l;
+	order[i].pos = i;
+    }
+    qsort (order, nlist, sizeof (rev_list_order), rev_list_name_compare);
+    rev_files = xmalloc ((nfile ? nfile : 1) * sizeof (rev_file *));
+    nrev_files = nfile;
+    mem_charge (MEM_FILE, 0, nfile * sizeof (rev_file *));
+    for (i = 0; i < nlist; i++) {
+	l = order[i].rl;
+	for (j = 0; j < l->nfiles; j++) {
+	    l->files[j]->index = index;
+	    rev_files[index++] = l->files[j];
+	}
+    }
+    free (order);
+    rev_dir_runs (rev_files, index);
+}
+
 rev_list *
-rev_list_merge (rev_list *head)
+rev_list_merge (rev_list *head, int nthreads)
 {
-    int		count = rev_list_count (head);
     rev_list	*rl = calloc (1, sizeof (rev_list));
-    rev_list	*l;
-    rev_ref	*lh, *h;
+    rev_ref	*h;
+    rev_branch	*b;
     Tag		*t;
-    rev_ref	**refs = calloc (count, sizeof (rev_ref *));
-    int		nref;
+    rev_merge_job *jobs, *job;
+    int		njob, i;
 
+    rev_list_index_files (head);
     /*
      * Find all of the heads across all of the incoming trees
-     * Yes, this is currently very inefficient
      */
-    for (l = head; l; l = l->next) {
-	for (lh = l->heads; lh; lh = lh->next) {
-	    h = rev_find_head (rl, lh->name);
-	    if (!h)
-		rev_list_add_head (rl, NULL, lh->name, lh->degree);
-	    else if (lh->degree > h->degree)
-		h->degree = lh->degree;
-	}
-    }
+    rev_branch_index (rl, head);
     /*
      * Sort by degree so that finding branch points always works
      */
 //    rl->heads = rev_ref_sel_sort (rl->heads);
-    rl->heads = rev_ref_tsort (rl->heads, head);
+    rl->heads = rev_ref_tsort (rl->heads);
     if (!rl->heads) {
-	free(refs);
+	rev_branch_index_free ();
 	return NULL;
     }
 //    for (h = rl->heads; h; h = h->next)
@@ -961,32 +1849,42 @@ rev_list_merge (rev_list *head)
      * Find branch parent relationships
      */
     for (h = rl->heads; h; h = h->next) {
-	rev_ref_set_parent (rl, h, head);
+	rev_ref_set_parent (h);
 //	dump_ref_name (stderr, h);
 //	fprintf (stderr, "\n");
     }
     /*
      * Merge common branches
      */
-    for (h = rl->heads; h; h = h->next) {
+    for (njob = 0, h = rl->heads; h; h = h->next)
+	njob++;
+    jobs = calloc (njob ? njob : 1, sizeof (rev_merge_job));
+    for (njob = 0, h = rl->heads; h; h = h->next) {
 	/*
 	 * Locate branch in every tree
 	 */
-	nref = 0;
-	for (l = head; l; l = l->next) {
-	    lh = rev_find_head (l, h->name);
-	    if (lh)
-		refs[nref++] = lh;
+	b = rev_branch_find (h->name);
+	if (!b->nref)
+	    continue;
+	job = &jobs[njob++];
+	job->head = h;
+	job->refs = b->refs;
+	job->nref = b->nref;
+	if (!(job->err = open_memstream (&job->msg, &job->nmsg))) {
+	    perror ("open_memstream");
+	    exit (1);
 	}
-	if (nref)
-	    rev_branch_merge (refs, nref, h, rl);
     }
+    rev_merge_jobs (jobs, njob, nthreads);
+    for (i = 0; i < njob; i++)
+	rev_merge_report (rl, &jobs[i]);
+    free (jobs);
     /*
      * Compute 'tail' values
      */
     rev_list_set_tail (rl);
 
-    free(refs);
+    rev_branch_index_free ();
     /*
      * Find tag locations
      */
@@ -1002,65 +1900,16 @@ rev_list_merge (rev_list *head)
     return rl;
 }
 
-/*
- * Icky. each file revision may be referenced many times in a single
- * tree. When freeing the tree, queue the file objects to be deleted
- * and clean them up afterwards
- */
-
-static rev_file *rev_files;
-
-static void
-rev_file_mark_for_free (rev_file *f)
-{
-    if (f->name) {
-	f->name = NULL;
-	f->link = rev_files;
-	rev_files = f;
-    }
-}
-
-static void
-rev_file_free_marked (void)
-{
-    rev_file	*f, *n;
-
-    for (f = rev_files; f; f = n)
-    {
-	n = f->link;
-	free (f);
-    }
-    rev_files = NULL;
-}
-
-rev_file *
-rev_file_rev (char *name, cvs_number *n, time_t date)
-{
-    rev_file	*f = calloc (1, sizeof (rev_file));
-
-    f->name = name;
-    f->number = *n;
-    f->date = date;
-    return f;
-}
-
-void
-rev_file_free (rev_file *f)
-{
-    free (f);
-}
-
 static void
 rev_commit_free (rev_commit *commit, int free_files)
+/* a master's commits are in its list's arena; merged ones are malloc()ed */
 {
     rev_commit	*c;
 
     while ((c = commit)) {
 	commit = c->parent;
-	if (--c->seen == 0)
-	{
-	    if (free_files && c->file)
-		rev_file_mark_for_free (c->file);
+	if (--c->seen == 0 && !free_files) {
+	    mem_charge (MEM_COMMIT, -1, -(long) sizeof (rev_commit));
 	    free (c);
 	}
     }
@@ -1082,8 +1931,10 @@ void
 rev_list_free (rev_list *rl, int free_files)
 {
     rev_head_free (rl->heads, free_files);
-    if (free_files)
-	rev_file_free_marked ();
+    mem_charge (MEM_FILE, 0, -(long) (rl->nfiles * sizeof (rev_file *)));
+    free (rl->files);
+    arena_free (&rl->commits);
+    arena_free (&rl->filerevs);
     free (rl);
 }
 
@@ -1110,23 +1961,26 @@ rev_list_validate (rev_list *rl)
 static rev_file_list *
 rev_uniq_file (rev_commit *uniq, rev_commit *common, int *nuniqp)
 {
-    int	i, j;
+    int	i, j, ndirs;
     int nuniq = 0;
     rev_file_list   *head = NULL, **tail = &head, *fl;
+    rev_dir	**dirs;
     
     if (!uniq)
 	return NULL;
-    for (i = 0; i < uniq->ndirs; i++) {
-	rev_dir	*dir = uniq->dirs[i];
+    dirs = rev_tree_dirs (uniq->tree, &ndirs);
+    for (i = 0; i < ndirs; i++) {
+	rev_dir	*dir = dirs[i];
 	for (j = 0; j < dir->nfiles; j++)
-	    if (!rev_commit_has_file (common, dir->files[j])) {
+	    if (!rev_commit_has_file (common, rev_dir_file (dir, j))) {
 		fl = calloc (1, sizeof (rev_file_list));
-		fl->file = dir->files[j];
+		fl->file = rev_dir_file (dir, j);
 		*tail = fl;
 		tail = &fl->next;
 		++nuniq;
 	    }
     }
+    free (dirs);
     *nuniqp = nuniq;
     return head;
 }
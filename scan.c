@@ -0,0 +1,166 @@
+/*
+ * Search routines for RCS @-strings.
+ *
+ * Both the lexer and the delta engine spend most of their time
+ * looking for the next '@' (and, when applying deltas, the next
+ * newline) so that the clean runs in between can be moved in bulk.
+ * On x86-64 these look at 16 bytes a step with SSE2, or 32 with
+ * AVX2 when the processor has it; elsewhere they fall back to plain
+ * byte loops.
+ *
+ * scan_line() has no end bound: it relies on the closing '@' that
+ * terminates every string in the master image.  Its vector loops
+ * only use aligned loads, which can't cross into a page that
+ * doesn't hold part of the string, but do read up to 31 bytes on
+ * either side of it.  That is harmless in a mapped master; a heap
+ * buffer must be SCAN_PAD-aligned and have SCAN_PAD bytes of
+ * padding after its end, as cvs_file_map() gives the masters it
+ * has to read().
+ *
+ * Callers also look at the byte after the '@' that scan_line()
+ * stops on, to tell a closing '@' from an "@@" escape, so that byte
+ * must be readable even when the '@' ends the master.  The padding
+ * covers a read() image; cvs_file_map() reads rather than maps a
+ * master that fills its last page, where the mapping would end at
+ * the '@'.
+ *
+ * The byte loops are built on every platform so that scanbench.c,
+ * which includes this file, can time them against the vector ones.
+ */
+
+#include "cvs.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef SCAN_X86
+__attribute__((target("avx2")))
+static const char *
+scan_at_avx2 (const char *p, const char *end)
+{
+    const __m256i	at = _mm256_set1_epi8 ('@');
+    unsigned		mask;
+
+    for (; end - p >= 32; p += 32) {
+	mask = _mm256_movemask_epi8 (
+	    _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *) p), at));
+	if (mask)
+	    return p + __builtin_ctz (mask);
+    }
+    for (; p < end; p++)
+	if (*p == '@')
+	    return p;
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_line_avx2 (const char *p)
+{
+    const __m256i	at = _mm256_set1_epi8 ('@');
+    const __m256i	nl = _mm256_set1_epi8 ('\n');
+    const char		*block = (const char *) ((uintptr_t) p & ~(uintptr_t) 31);
+    unsigned		mask;
+    __m256i		v;
+
+    v = _mm256_load_si256 ((const __m256i *) block);
+    mask = _mm256_movemask_epi8 (_mm256_or_si256 (_mm256_cmpeq_epi8 (v, at),
+						  _mm256_cmpeq_epi8 (v, nl)));
+    mask &= ~0u << (p - block);
+    while (!mask) {
+	block += 32;
+	v = _mm256_load_si256 ((const __m256i *) block);
+	mask = _mm256_movemask_epi8 (
+	    _mm256_or_si256 (_mm256_cmpeq_epi8 (v, at),
+			     _mm256_cmpeq_epi8 (v, nl)));
+    }
+    return block + __builtin_ctz (mask);
+}
+
+static const char *
+scan_at_sse2 (const char *p, const char *end)
+{
+    const __m128i	at = _mm_set1_epi8 ('@');
+    unsigned		mask;
+
+    for (; end - p >= 16; p += 16) {
+	mask = _mm_movemask_epi8 (
+	    _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i *) p), at));
+	if (mask)
+	    return p + __builtin_ctz (mask);
+    }
+    for (; p < end; p++)
+	if (*p == '@')
+	    return p;
+    return NULL;
+}
+
+static const char *
+scan_line_sse2 (const char *p)
+{
+    const __m128i	at = _mm_set1_epi8 ('@');
+    const __m128i	nl = _mm_set1_epi8 ('\n');
+    const char		*block = (const char *) ((uintptr_t) p & ~(uintptr_t) 15);
+    unsigned		mask;
+    __m128i		v;
+
+    v = _mm_load_si128 ((const __m128i *) block);
+    mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, at),
+					    _mm_cmpeq_epi8 (v, nl)));
+    mask &= ~0u << (p - block);
+    while (!mask) {
+	block += 16;
+	v = _mm_load_si128 ((const __m128i *) block);
+	mask = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, at),
+						_mm_cmpeq_epi8 (v, nl)));
+    }
+    return block + __builtin_ctz (mask);
+}
+#endif
+
+static const char *
+scan_at_scalar (const char *p, const char *end)
+{
+    for (; p < end; p++)
+	if (*p == '@')
+	    return p;
+    return NULL;
+}
+
+static const char *
+scan_line_scalar (const char *p)
+{
+    while (*p != '@' && *p != '\n')
+	p++;
+    return p;
+}
+
+const char *
+scan_at (const char *p, const char *end)
+/* find the first '@' in [p, end), or NULL */
+{
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports ("avx2"))
+	return scan_at_avx2 (p, end);
+    return scan_at_sse2 (p, end);
+#else
+    return scan_at_scalar (p, end);
+#endif
+}
+
+const char *
+scan_line (const char *p)
+/* find the first '@' or newline at or after p; one must follow */
+{
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports ("avx2"))
+	return scan_line_avx2 (p);
+    return scan_line_sse2 (p);
+#else
+    return scan_line_scalar (p);
+#endif
+}
+
+/* end */
@@ -0,0 +1,229 @@
+/*
+ * Benchmark for the @-string search routines in scan.c.
+ *
+ * The named ,v masters are read into memory and every '@' in them
+ * is found with each version of scan_at(), then every '@' or
+ * newline with each version of scan_line().  The baselines are the
+ * code these replaced: memchr() in the lexer, and a character at a
+ * time through a getc-like call in the delta engine.  Each version
+ * must find the same positions as the first, or the run fails.
+ *
+ * usage: scanbench [-n rounds] master,v...
+ */
+
+#include "scan.c"
+#include <sys/stat.h>
+
+/* room past the end for the sentinel and the widest aligned load */
+#define SCAN_SLOP	64
+
+typedef struct {
+    char	*text;
+    size_t	len;
+} master_t;
+
+static master_t	*masters;
+static int	nmasters;
+static size_t	total;
+
+static __attribute__((noinline)) int
+byte_getc (const char **pp)
+/* one character per call, as in_buffer_getc() used to deliver them */
+{
+    return *(*pp)++;
+}
+
+static const char *
+byte_at (const char *p, const char *end)
+{
+    while (p < end)
+	if (byte_getc (&p) == '@')
+	    return p - 1;
+    return NULL;
+}
+
+static const char *
+byte_line (const char *p)
+{
+    int	c;
+
+    do
+	c = byte_getc (&p);
+    while (c != '@' && c != '\n');
+    return p - 1;
+}
+
+static const char *
+memchr_at (const char *p, const char *end)
+{
+    return memchr (p, '@', end - p);
+}
+
+#ifdef SCAN_X86
+static int
+have_avx2 (void)
+{
+    return __builtin_cpu_supports ("avx2");
+}
+#endif
+
+static int
+always (void)
+{
+    return 1;
+}
+
+static const struct {
+    const char	*name;
+    const char	*(*at) (const char *, const char *);
+    int		(*usable) (void);
+} at_scans[] = {
+    { "byte loop", byte_at, always },
+    { "memchr", memchr_at, always },
+    { "scalar", scan_at_scalar, always },
+#ifdef SCAN_X86
+    { "sse2", scan_at_sse2, always },
+    { "avx2", scan_at_avx2, have_avx2 },
+#endif
+    { "scan_at", scan_at, always },
+};
+
+static const struct {
+    const char	*name;
+    const char	*(*line) (const char *);
+    int		(*usable) (void);
+} line_scans[] = {
+    { "byte loop", byte_line, always },
+    { "scalar", scan_line_scalar, always },
+#ifdef SCAN_X86
+    { "sse2", scan_line_sse2, always },
+    { "avx2", scan_line_avx2, have_avx2 },
+#endif
+    { "scan_line", scan_line, always },
+};
+
+static void
+load_master (const char *name)
+{
+    struct stat	st;
+    FILE	*f;
+    master_t	*m;
+
+    if (!(f = fopen (name, "r")) || fstat (fileno (f), &st) < 0) {
+	perror (name);
+	exit (1);
+    }
+    masters = realloc (masters, (nmasters + 1) * sizeof (master_t));
+    m = &masters[nmasters++];
+    m->len = st.st_size;
+    /* scan_line() wants its sentinel; aligned loads may run past it */
+    if (posix_memalign ((void **) &m->text, SCAN_SLOP, m->len + SCAN_SLOP)) {
+	fprintf (stderr, "scanbench: out of memory\n");
+	exit (1);
+    }
+    if (fread (m->text, 1, m->len, f) != m->len) {
+	perror (name);
+	exit (1);
+    }
+    memset (m->text + m->len, '@', SCAN_SLOP);
+    fclose (f);
+    total += m->len;
+}
+
+static double
+now (void)
+{
+    struct timespec	ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *kind, const char *name, int rounds, double t,
+	uint64_t found, uint64_t sum, uint64_t *ref_found, uint64_t *ref_sum)
+/* print a timing, checking the positions against the first version's */
+{
+    if (*ref_found == 0 && *ref_sum == 0) {
+	*ref_found = found;
+	*ref_sum = sum;
+    } else if (found != *ref_found || sum != *ref_sum) {
+	fprintf (stderr, "scanbench: %s %s found %llu stops, expected %llu\n",
+		 kind, name, (unsigned long long) found,
+		 (unsigned long long) *ref_found);
+	exit (1);
+    }
+    printf ("%-9s %-10s %9.1f MB/s\n", kind, name,
+	    (double) total * rounds / t / 1e6);
+}
+
+int
+main (int argc, char **argv)
+{
+    int		rounds = 20;
+    uint64_t	found, sum, ref_found, ref_sum;
+    const char	*p, *q, *end;
+    double	t;
+    int		c, i, r, m;
+
+    while ((c = getopt (argc, argv, "n:")) != -1) {
+	switch (c) {
+	case 'n':
+	    rounds = atoi (optarg);
+	    break;
+	default:
+	    fprintf (stderr, "usage: scanbench [-n rounds] master,v...\n");
+	    exit (1);
+	}
+    }
+    if (rounds <= 0 || optind == argc) {
+	fprintf (stderr, "usage: scanbench [-n rounds] master,v...\n");
+	exit (1);
+    }
+    for (i = optind; i < argc; i++)
+	load_master (argv[i]);
+    printf ("%d masters, %.1f MB, %d rounds\n", nmasters, total / 1e6, rounds);
+
+    ref_found = ref_sum = 0;
+    for (i = 0; i < sizeof (at_scans) / sizeof (at_scans[0]); i++) {
+	if (!at_scans[i].usable ())
+	    continue;
+	found = sum = 0;
+	t = now ();
+	for (r = 0; r < rounds; r++)
+	    for (m = 0; m < nmasters; m++) {
+		p = masters[m].text;
+		end = p + masters[m].len;
+		while ((q = at_scans[i].at (p, end))) {
+		    found++;
+		    sum += q - masters[m].text;
+		    p = q + 1;
+		}
+	    }
+	t = now () - t;
+	report ("'@'", at_scans[i].name, rounds, t,
+		found, sum, &ref_found, &ref_sum);
+    }
+
+    ref_found = ref_sum = 0;
+    for (i = 0; i < sizeof (line_scans) / sizeof (line_scans[0]); i++) {
+	if (!line_scans[i].usable ())
+	    continue;
+	found = sum = 0;
+	t = now ();
+	for (r = 0; r < rounds; r++)
+	    for (m = 0; m < nmasters; m++) {
+		p = masters[m].text;
+		end = p + masters[m].len;
+		while ((q = line_scans[i].line (p)) < end) {
+		    found++;
+		    sum += q - masters[m].text;
+		    p = q + 1;
+		}
+	    }
+	t = now () - t;
+	report ("'@' or nl", line_scans[i].name, rounds, t,
+		found, sum, &ref_found, &ref_sum);
+    }
+    return 0;
+}
@@ -28,6 +28,7 @@ static Tag *find_tag(char *name)
 		if (tag->name == name)
 			return tag;
 	tag = calloc(1, sizeof(Tag));
+	mem_charge(MEM_TAG, 1, sizeof(Tag));
 	tag->name = name;
 	tag->hash_next = table[hash];
 	table[hash] = tag;
@@ -36,18 +37,19 @@ static Tag *find_tag(char *name)
 	return tag;
 }
 
-void tag_commit(rev_commit *c, char *name)
-/* add a commit to the list associated with a named tag (this_file implicit) */
+void tag_commit(rev_commit *c, char *name, char *filename)
+/* add a commit to the list associated with a named tag */
 {
 	Tag *tag = find_tag(name);
-	if (tag->last == this_file->name) {
+	if (tag->last == filename) {
 		fprintf(stderr, "duplicate tag %s in %s, ignoring\n",
-			name, this_file->name);
+			name, filename);
 		return;
 	}
-	tag->last = this_file->name;
+	tag->last = filename;
 	if (!tag->left) {
 		Chunk *v = malloc(sizeof(Chunk));
+		mem_charge(MEM_TAG, 1, sizeof(Chunk));
 		v->next = tag->commits;
 		tag->commits = v;
 		tag->left = Ncommits;
@@ -56,6 +58,35 @@ void tag_commit(rev_commit *c, char *name)
 	tag->count++;
 }
 
+void tag_queue(rev_list *rl, rev_commit *c, char *name)
+/* remember a tag on a file's commit; the loader threads can't touch the table */
+{
+	rev_tag *t = xmalloc(sizeof(rev_tag));
+	t->commit = c;
+	t->name = name;
+	t->next = rl->tags;
+	rl->tags = t;
+}
+
+void tag_flush(rev_list *rl, char *filename)
+/* apply a file's queued tags in the order they were found */
+{
+	rev_tag *t = rl->tags, *prev = NULL, *next;
+
+	while (t) {
+		next = t->next;
+		t->next = prev;
+		prev = t;
+		t = next;
+	}
+	rl->tags = NULL;
+	for (t = prev; t; t = next) {
+		next = t->next;
+		tag_commit(t->commit, t->name, filename);
+		free(t);
+	}
+}
+
 rev_commit **tagged(Tag *tag)
 /* return an allocated list of of pointers to commits with the specified tag */
 {
@@ -85,9 +116,11 @@ void discard_tags(void)
 		Chunk *c = tag->commits;
 		while (c) {
 			Chunk *next = c->next;
+			mem_charge(MEM_TAG, -1, -(long)sizeof(Chunk));
 			free(c);
 			c = next;
 		}
+		mem_charge(MEM_TAG, -1, -(long)sizeof(Tag));
 		free(tag);
 		tag = p;
 	}
@@ -0,0 +1,242 @@
+/*
+ * Walk a CVS repository for its master files, as an alternative to
+ * feeding the names in from find(1).
+ *
+ * Directories are read with getdents64 so the entry types come for
+ * free; a file only gets stat()ed when its type is unknown or a link,
+ * or when the caller wants sizes.  Directory scans are spread over a
+ * small pool of threads, and the result is sorted so it matches
+ * "find DIR -name '*,v' | sort".
+ */
+
+#include "cvs.h"
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+typedef struct _walk_dir {
+    struct _walk_dir	*next;
+    char		*path;
+} walk_dir;
+
+static struct {
+    pthread_mutex_t	lock;
+    pthread_cond_t	wake;
+    walk_dir		*dirs;		/* directories waiting to be read */
+    int			busy;		/* queued plus being read */
+    walk_file		*files;
+    int			nfiles, sfiles;
+    bool		sizes;
+} walk = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+};
+
+static char *
+walk_join (char *dir, char *name)
+/* make the path of a directory entry */
+{
+    size_t  dlen = strlen (dir);
+    char    *path = xmalloc (dlen + strlen (name) + 2);
+
+    memcpy (path, dir, dlen);
+    if (dlen == 0 || dir[dlen-1] != '/')
+	path[dlen++] = '/';
+    strcpy (path + dlen, name);
+    return path;
+}
+
+static bool
+is_master (char *name)
+/* does this look like an RCS master? */
+{
+    size_t  len = strlen (name);
+
+    return len > 2 && name[len-2] == ',' && name[len-1] == 'v';
+}
+
+static void
+walk_queue (char *path)
+/* add a directory to the to-do list; walk.lock must be held */
+{
+    walk_dir	*d = xmalloc (sizeof (walk_dir));
+
+    d->path = path;
+    d->next = walk.dirs;
+    walk.dirs = d;
+    walk.busy++;
+    pthread_cond_signal (&walk.wake);
+}
+
+static void
+walk_entry (int dirfd, char *dir, char *name, unsigned char type)
+/* sort out one directory entry */
+{
+    struct stat	st;
+    bool	have_stat = false;
+    char	*path;
+
+    if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+	return;
+    if (type == DT_UNKNOWN || type == DT_LNK) {
+	/* like find, don't descend through symlinks, but do take files */
+	if (fstatat (dirfd, name, &st,
+		     type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW) != 0)
+	    return;
+	have_stat = true;
+	if (S_ISDIR (st.st_mode))
+	    type = type == DT_LNK ? DT_UNKNOWN : DT_DIR;
+	else if (S_ISREG (st.st_mode))
+	    type = DT_REG;
+	else
+	    return;
+    }
+    if (type == DT_DIR) {
+	path = walk_join (dir, name);
+	pthread_mutex_lock (&walk.lock);
+	walk_queue (path);
+	pthread_mutex_unlock (&walk.lock);
+	return;
+    }
+    if (type != DT_REG || !is_master (name))
+	return;
+    if (walk.sizes && !have_stat) {
+	if (fstatat (dirfd, name, &st, 0) != 0)
+	    return;
+	have_stat = true;
+    }
+    path = walk_join (dir, name);
+    pthread_mutex_lock (&walk.lock);
+    if (walk.nfiles == walk.sfiles) {
+	walk.sfiles = walk.sfiles ? walk.sfiles * 2 : 1024;
+	walk.files = xrealloc (walk.files, walk.sfiles * sizeof (walk_file));
+    }
+    walk.files[walk.nfiles].name = atom (path);
+    walk.files[walk.nfiles].size = have_stat ? st.st_size : -1;
+    walk.nfiles++;
+    pthread_mutex_unlock (&walk.lock);
+    free (path);
+}
+
+#ifdef SYS_getdents64
+struct walk_dirent64 {
+    uint64_t		d_ino;
+    int64_t		d_off;
+    unsigned short	d_reclen;
+    unsigned char	d_type;
+    char		d_name[];
+};
+
+static void
+walk_read (char *dir)
+/* read one directory, queueing subdirectories and recording masters */
+{
+    /* the kernel lays the records out 8-byte aligned within buf */
+    char    buf[32768] __attribute__((aligned (8)));
+    long    n, off;
+    int	    fd;
+
+    fd = openat (AT_FDCWD, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+	perror (dir);
+	return;
+    }
+    while ((n = syscall (SYS_getdents64, fd, buf, sizeof (buf))) > 0)
+	for (off = 0; off < n; ) {
+	    struct walk_dirent64 *d = (struct walk_dirent64 *) (buf + off);
+
+	    walk_entry (fd, dir, d->d_name, d->d_type);
+	    off += d->d_reclen;
+	}
+    if (n < 0)
+	perror (dir);
+    close (fd);
+}
+#else
+static void
+walk_read (char *dir)
+/* read one directory, queueing subdirectories and recording masters */
+{
+    struct dirent   *d;
+    DIR		    *dp;
+    int		    fd;
+
+    fd = openat (AT_FDCWD, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || !(dp = fdopendir (fd))) {
+	perror (dir);
+	if (fd >= 0)
+	    close (fd);
+	return;
+    }
+    while ((d = readdir (dp)))
+	walk_entry (fd, dir, d->d_name, d->d_type);
+    closedir (dp);
+}
+#endif
+
+static void *
+walk_worker (void *arg)
+/* read directories until there are none left anywhere */
+{
+    walk_dir	*d;
+
+    pthread_mutex_lock (&walk.lock);
+    for (;;) {
+	while (!walk.dirs && walk.busy)
+	    pthread_cond_wait (&walk.wake, &walk.lock);
+	if (!walk.dirs)
+	    break;
+	d = walk.dirs;
+	walk.dirs = d->next;
+	pthread_mutex_unlock (&walk.lock);
+	walk_read (d->path);
+	free (d->path);
+	free (d);
+	pthread_mutex_lock (&walk.lock);
+	if (--walk.busy == 0)
+	    pthread_cond_broadcast (&walk.wake);
+    }
+    pthread_mutex_unlock (&walk.lock);
+    return NULL;
+}
+
+static int
+walk_compare (const void *a, const void *b)
+{
+    return strcmp (((walk_file *) a)->name, ((walk_file *) b)->name);
+}
+
+walk_file *
+walk_tree (char *root, int nthreads, bool sizes, int *nfiles)
+/* return a sorted array of the masters under root */
+{
+    pthread_t	*workers;
+    int		i;
+
+    walk.sizes = sizes;
+    walk.files = NULL;
+    walk.nfiles = walk.sfiles = 0;
+    pthread_mutex_lock (&walk.lock);
+    walk_queue (strdup (root));
+    pthread_mutex_unlock (&walk.lock);
+    if (nthreads <= 1)
+	walk_worker (NULL);
+    else {
+	workers = xmalloc (nthreads * sizeof (pthread_t));
+	for (i = 0; i < nthreads; i++)
+	    if (pthread_create (&workers[i], NULL, walk_worker, NULL) != 0) {
+		perror ("pthread_create");
+		exit (1);
+	    }
+	for (i = 0; i < nthreads; i++)
+	    pthread_join (workers[i], NULL);
+	free (workers);
+    }
+    qsort (walk.files, walk.nfiles, sizeof (walk_file), walk_compare);
+    *nfiles = walk.nfiles;
+    return walk.files;
+}
+
+/* end */